@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+void arena_init(struct arena *a, size_t block_size)
+{
+	a->head = NULL;
+	a->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+static struct arena_block *arena_new_block(struct arena *a, size_t size)
+{
+	struct arena_block *b;
+
+	// a zeroed arena (e.g. a static one) uses the default block size
+	if (!a->block_size)
+		a->block_size = ARENA_BLOCK_SIZE;
+
+	if (size < a->block_size)
+		size = a->block_size;
+
+	b = malloc(sizeof(*b) + size);
+	DIE(b == NULL, "Error allocating arena block.");
+
+	b->size = size;
+	b->used = 0;
+	b->next = a->head;
+	a->head = b;
+
+	return b;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_block *b = a->head;
+	void *ptr;
+
+	size = ALIGN_UP(size);
+	if (!b || b->size - b->used < size)
+		b = arena_new_block(a, size);
+
+	ptr = b->data + b->used;
+	b->used += size;
+
+	return ptr;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy = arena_alloc(a, len);
+
+	memcpy(copy, s, len);
+
+	return copy;
+}
+
+void arena_reset(struct arena *a)
+{
+	struct arena_block *b = a->head, *next, *keep = NULL;
+
+	// keep one block of the default size, oversized ones are released
+	for (; b; b = next) {
+		next = b->next;
+		if (!keep && b->size == a->block_size) {
+			keep = b;
+			continue;
+		}
+		free(b);
+	}
+
+	if (keep) {
+		keep->used = 0;
+		keep->next = NULL;
+	}
+	a->head = keep;
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_block *b = a->head, *next;
+
+	while (b) {
+		next = b->next;
+		free(b);
+		b = next;
+	}
+
+	a->head = NULL;
+}
+
+size_t arena_size(struct arena *a)
+{
+	struct arena_block *b;
+	size_t size = 0;
+
+	for (b = a->head; b; b = b->next)
+		size += b->size;
+
+	return size;
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+// default size of an arena block, bigger requests get their own block
+#define ARENA_BLOCK_SIZE 4096
+
+// every allocation is aligned to the size of a pointer
+#define ARENA_ALIGN sizeof(void *)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+/**
+ * Bump allocator: memory is handed out from big blocks and released all at
+ * once by arena_reset() or arena_free(). A zeroed arena is ready to use.
+ */
+struct arena {
+	struct arena_block *head;
+	size_t block_size;
+};
+
+/**
+ * Initialize an empty arena whose blocks hold at least block_size bytes.
+ */
+void arena_init(struct arena *a, size_t block_size);
+
+/**
+ * Allocate size bytes from the arena (never returns NULL).
+ */
+void *arena_alloc(struct arena *a, size_t size);
+
+/**
+ * Copy a string into the arena.
+ */
+char *arena_strdup(struct arena *a, const char *s);
+
+/**
+ * Forget every allocation but keep one block of the default size for reuse.
+ */
+void arena_reset(struct arena *a);
+
+/**
+ * Release all the memory owned by the arena.
+ */
+void arena_free(struct arena *a);
+
+/**
+ * Number of bytes currently reserved by the arena blocks.
+ */
+size_t arena_size(struct arena *a);
+
+#endif /* _ARENA_H */
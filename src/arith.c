@@ -0,0 +1,462 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "cmd.h"
+#include "utils.h"
+#include "vars.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+enum arith_op {
+	ARITH_ASSIGN,
+	ARITH_OR,
+	ARITH_AND,
+	ARITH_BIT_OR,
+	ARITH_BIT_XOR,
+	ARITH_BIT_AND,
+	ARITH_EQ,
+	ARITH_NE,
+	ARITH_LE,
+	ARITH_GE,
+	ARITH_LT,
+	ARITH_GT,
+	ARITH_SHL,
+	ARITH_SHR,
+	ARITH_ADD,
+	ARITH_SUB,
+	ARITH_MUL,
+	ARITH_DIV,
+	ARITH_MOD,
+	ARITH_POW
+};
+
+struct arith_token {
+	const char *token;
+	enum arith_op op;
+	int prec;
+};
+
+// a token is listed before the shorter ones it starts with
+static const struct arith_token binary_ops[] = {
+	{ "||", ARITH_OR, 1 },
+	{ "&&", ARITH_AND, 2 },
+	{ "==", ARITH_EQ, 6 },
+	{ "!=", ARITH_NE, 6 },
+	{ "<=", ARITH_LE, 7 },
+	{ ">=", ARITH_GE, 7 },
+	{ "<<", ARITH_SHL, 8 },
+	{ ">>", ARITH_SHR, 8 },
+	{ "**", ARITH_POW, 11 },
+	{ "|", ARITH_BIT_OR, 3 },
+	{ "^", ARITH_BIT_XOR, 4 },
+	{ "&", ARITH_BIT_AND, 5 },
+	{ "<", ARITH_LT, 7 },
+	{ ">", ARITH_GT, 7 },
+	{ "+", ARITH_ADD, 9 },
+	{ "-", ARITH_SUB, 9 },
+	{ "*", ARITH_MUL, 10 },
+	{ "/", ARITH_DIV, 10 },
+	{ "%", ARITH_MOD, 10 },
+};
+
+static const struct arith_token assign_ops[] = {
+	{ "<<=", ARITH_SHL, 0 },
+	{ ">>=", ARITH_SHR, 0 },
+	{ "+=", ARITH_ADD, 0 },
+	{ "-=", ARITH_SUB, 0 },
+	{ "*=", ARITH_MUL, 0 },
+	{ "/=", ARITH_DIV, 0 },
+	{ "%=", ARITH_MOD, 0 },
+	{ "&=", ARITH_BIT_AND, 0 },
+	{ "^=", ARITH_BIT_XOR, 0 },
+	{ "|=", ARITH_BIT_OR, 0 },
+	{ "=", ARITH_ASSIGN, 0 },
+};
+
+struct arith {
+	const char *pos;
+	const char *error;
+	int depth;
+
+	// inside a branch that is not taken: parse only, without side effects
+	bool skip;
+};
+
+static long long comma(struct arith *p);
+static long long assign(struct arith *p);
+static long long unary(struct arith *p);
+
+static long long fail(struct arith *p, const char *error)
+{
+	if (!p->error)
+		p->error = error;
+
+	return 0;
+}
+
+static bool enter(struct arith *p)
+{
+	if (++p->depth > ARITH_MAX_DEPTH) {
+		fail(p, "expression nested too deeply");
+		return false;
+	}
+
+	return true;
+}
+
+static void skip_blanks(struct arith *p)
+{
+	while (isspace((unsigned char)*p->pos))
+		p->pos++;
+}
+
+static bool accept(struct arith *p, const char *token)
+{
+	size_t len = strlen(token);
+
+	skip_blanks(p);
+	if (strncmp(p->pos, token, len) != 0)
+		return false;
+
+	p->pos += len;
+
+	return true;
+}
+
+static size_t name_length(const char *s)
+{
+	size_t len = 0;
+
+	if (!isalpha((unsigned char)*s) && *s != '_')
+		return 0;
+
+	while (isalnum((unsigned char)s[len]) || s[len] == '_')
+		len++;
+
+	return len;
+}
+
+/**
+ * Value of a variable: its text is itself evaluated as an expression, so
+ * that a=b+1 works like in bash. The depth stops self references.
+ */
+static long long get_var(struct arith *p, const char *name, size_t len)
+{
+	struct arith sub = { NULL, NULL, p->depth, p->skip };
+	const char *value;
+	long long result;
+	char *copy;
+
+	copy = strndup(name, len);
+	DIE(copy == NULL, "Error allocating variable name.");
+	value = vars_get(copy);
+	free(copy);
+
+	if (!value)
+		return 0;
+
+	sub.pos = value;
+	if (!enter(&sub))
+		return fail(p, sub.error);
+
+	skip_blanks(&sub);
+	result = *sub.pos ? comma(&sub) : 0;
+	skip_blanks(&sub);
+
+	if (!sub.error && *sub.pos)
+		sub.error = "invalid number";
+	if (sub.error)
+		return fail(p, sub.error);
+
+	return result;
+}
+
+static void set_var(struct arith *p, const char *name, size_t len, long long value)
+{
+	char number[NUMBER_SIZE];
+	char *copy;
+
+	if (p->skip || p->error)
+		return;
+
+	snprintf(number, sizeof(number), "%lld", value);
+
+	copy = strndup(name, len);
+	DIE(copy == NULL, "Error allocating variable name.");
+	vars_set(copy, number);
+	free(copy);
+}
+
+/**
+ * Apply a binary operator; overflow wraps around instead of being undefined.
+ */
+static long long apply(struct arith *p, enum arith_op op, long long a, long long b)
+{
+	unsigned long long ua = a, ub = b, power = 1;
+
+	switch (op) {
+	case ARITH_OR:
+		return a || b;
+	case ARITH_AND:
+		return a && b;
+	case ARITH_BIT_OR:
+		return a | b;
+	case ARITH_BIT_XOR:
+		return a ^ b;
+	case ARITH_BIT_AND:
+		return a & b;
+	case ARITH_EQ:
+		return a == b;
+	case ARITH_NE:
+		return a != b;
+	case ARITH_LE:
+		return a <= b;
+	case ARITH_GE:
+		return a >= b;
+	case ARITH_LT:
+		return a < b;
+	case ARITH_GT:
+		return a > b;
+	case ARITH_SHL:
+		return (long long)(ua << (b & 63));
+	case ARITH_SHR:
+		return a >> (b & 63);
+	case ARITH_ADD:
+		return (long long)(ua + ub);
+	case ARITH_SUB:
+		return (long long)(ua - ub);
+	case ARITH_MUL:
+		return (long long)(ua * ub);
+	case ARITH_DIV:
+	case ARITH_MOD:
+		if (p->skip)
+			return 0;
+		if (b == 0)
+			return fail(p, "division by 0");
+		// the only quotient that overflows, LLONG_MIN / -1
+		if (b == -1)
+			return op == ARITH_DIV ? (long long)(0 - ua) : 0;
+		return op == ARITH_DIV ? a / b : a % b;
+	case ARITH_POW:
+		if (b < 0)
+			return p->skip ? 0 : fail(p, "exponent less than 0");
+		for (; ub; ub >>= 1, ua *= ua)
+			if (ub & 1)
+				power *= ua;
+		return (long long)power;
+	default:
+		return b;
+	}
+}
+
+/**
+ * Number, variable (with its postfix ++ or --) or parenthesized expression.
+ */
+static long long primary(struct arith *p)
+{
+	const char *name, *end;
+	long long value;
+	size_t len;
+
+	skip_blanks(p);
+
+	// $name and $((expr)) read the same as name and ((expr))
+	if (*p->pos == '$')
+		p->pos++;
+
+	if (accept(p, "(")) {
+		value = comma(p);
+		if (!accept(p, ")"))
+			return fail(p, "missing ')'");
+		return value;
+	}
+
+	if (isdigit((unsigned char)*p->pos)) {
+		value = (long long)strtoull(p->pos, (char **)&end, 0);
+		if (isalnum((unsigned char)*end) || *end == '_')
+			return fail(p, "invalid number");
+		p->pos = end;
+		return value;
+	}
+
+	len = name_length(p->pos);
+	if (!len)
+		return fail(p, *p->pos ? "syntax error" : "operand expected");
+
+	name = p->pos;
+	p->pos += len;
+	value = get_var(p, name, len);
+
+	if (accept(p, "++"))
+		set_var(p, name, len, apply(p, ARITH_ADD, value, 1));
+	else if (accept(p, "--"))
+		set_var(p, name, len, apply(p, ARITH_SUB, value, 1));
+
+	return value;
+}
+
+static long long unary(struct arith *p)
+{
+	const char *name;
+	long long value;
+	bool increment;
+	size_t len;
+
+	if (!enter(p)) {
+		value = 0;
+	} else if ((increment = accept(p, "++")) || accept(p, "--")) {
+		skip_blanks(p);
+		name = p->pos;
+		len = name_length(name);
+		if (!len) {
+			value = fail(p, "variable expected");
+		} else {
+			p->pos += len;
+			value = apply(p, increment ? ARITH_ADD : ARITH_SUB, get_var(p, name, len), 1);
+			set_var(p, name, len, value);
+		}
+	} else if (accept(p, "+")) {
+		value = unary(p);
+	} else if (accept(p, "-")) {
+		value = apply(p, ARITH_SUB, 0, unary(p));
+	} else if (accept(p, "!")) {
+		value = !unary(p);
+	} else if (accept(p, "~")) {
+		value = ~unary(p);
+	} else {
+		value = primary(p);
+	}
+
+	p->depth--;
+
+	return value;
+}
+
+static const struct arith_token *peek_binary(struct arith *p)
+{
+	size_t i;
+
+	skip_blanks(p);
+	for (i = 0; i < ARRAY_SIZE(binary_ops); i++)
+		if (strncmp(p->pos, binary_ops[i].token, strlen(binary_ops[i].token)) == 0)
+			return &binary_ops[i];
+
+	return NULL;
+}
+
+/**
+ * Precedence climbing over the binary operators of at least min_prec.
+ */
+static long long binary(struct arith *p, int min_prec)
+{
+	const struct arith_token *op;
+	long long lhs = unary(p), rhs;
+	bool skip;
+
+	while (!p->error && (op = peek_binary(p)) && op->prec >= min_prec) {
+		p->pos += strlen(op->token);
+
+		// the right operand of && and || is only evaluated when needed
+		skip = p->skip;
+		if ((op->op == ARITH_AND && !lhs) || (op->op == ARITH_OR && lhs))
+			p->skip = true;
+
+		// ** is right associative, the others are left associative
+		rhs = binary(p, op->op == ARITH_POW ? op->prec : op->prec + 1);
+		p->skip = skip;
+
+		lhs = apply(p, op->op, lhs, rhs);
+	}
+
+	return lhs;
+}
+
+static long long ternary(struct arith *p)
+{
+	long long cond = binary(p, 1), a, b;
+	bool skip = p->skip;
+
+	if (!accept(p, "?"))
+		return cond;
+
+	p->skip = skip || !cond;
+	a = assign(p);
+	if (!accept(p, ":"))
+		return fail(p, "missing ':'");
+
+	p->skip = skip || cond;
+	b = assign(p);
+	p->skip = skip;
+
+	return cond ? a : b;
+}
+
+static long long assign(struct arith *p)
+{
+	const char *start, *name;
+	long long value;
+	size_t len, i;
+
+	skip_blanks(p);
+	start = name = p->pos;
+	len = name_length(name);
+
+	if (len && enter(p)) {
+		p->pos += len;
+		for (i = 0; i < ARRAY_SIZE(assign_ops); i++) {
+			if (!accept(p, assign_ops[i].token))
+				continue;
+
+			// = is not the start of ==
+			if (assign_ops[i].op == ARITH_ASSIGN && *p->pos == '=')
+				break;
+
+			value = assign(p);
+			if (assign_ops[i].op != ARITH_ASSIGN)
+				value = apply(p, assign_ops[i].op, get_var(p, name, len), value);
+			set_var(p, name, len, value);
+			p->depth--;
+
+			return value;
+		}
+		p->depth--;
+	}
+
+	p->pos = start;
+
+	return ternary(p);
+}
+
+static long long comma(struct arith *p)
+{
+	long long value = assign(p);
+
+	while (!p->error && accept(p, ","))
+		value = assign(p);
+
+	return value;
+}
+
+int arith_eval(const char *expr, long long *result)
+{
+	struct arith p = { expr, NULL, 0, false };
+
+	skip_blanks(&p);
+	*result = *p.pos ? comma(&p) : 0;
+	skip_blanks(&p);
+
+	if (!p.error && *p.pos)
+		p.error = "syntax error";
+
+	if (p.error) {
+		fprintf(stderr, "Arithmetic error in '%s': %s\n", expr, p.error);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
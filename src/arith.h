@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ARITH_H
+#define _ARITH_H
+
+// nesting of parentheses and unary operators an expression may have
+#define ARITH_MAX_DEPTH 256
+
+/*
+ * Arithmetic expansion, $(( expr ))
+
+ * Expressions are evaluated in-process over 64-bit signed integers, with
+ * the C operators and precedences: unary + - ! ~, ++ and -- (prefix and
+ * postfix), * / %, + -, << >>, comparisons, & ^ |, && ||, ?: , the
+ * assignments (= += -= ...) and the comma operator. Numbers are decimal,
+ * hexadecimal (0x) or octal (leading 0). Variables are read by name, with
+ * or without $; an unset or empty one counts as 0. Overflow wraps around.
+ */
+
+/**
+ * Evaluate an arithmetic expression, reading and assigning shell variables.
+ * Returns SUCCESS and stores the value in result, or prints the error and
+ * returns ERROR.
+ */
+int arith_eval(const char *expr, long long *result);
+
+#endif /* _ARITH_H */
@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brace.h"
+#include "utils.h"
+
+enum brace_type {
+	BRACE_TEXT,
+	BRACE_LIST,
+	BRACE_RANGE
+};
+
+struct brace_item {
+	enum brace_type type;
+
+	// BRACE_TEXT
+	const char *text;
+	size_t len;
+
+	// BRACE_LIST
+	struct brace_seq *alts;
+	size_t nalts;
+
+	// BRACE_RANGE: n values from first, step apart (step < 0 goes down)
+	long long first;
+	long long step;
+	size_t n;
+	int width;
+	bool chars;
+
+	struct brace_item *next;
+};
+
+/**
+ * Alternative of a list being generated: after its items, the generation
+ * goes on with the items following the list.
+ */
+struct frame {
+	const struct brace_item *item;
+	const struct frame *up;
+};
+
+struct generator {
+	char *buf;
+	brace_emit_t emit;
+	void *data;
+};
+
+static size_t add_count(size_t a, size_t b)
+{
+	return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+static size_t mul_count(size_t a, size_t b)
+{
+	return a && b > SIZE_MAX / a ? SIZE_MAX : a * b;
+}
+
+static void add_item(struct brace_seq *seq, struct brace_item *item, size_t count,
+		     size_t max_len)
+{
+	item->next = NULL;
+	*seq->tail = item;
+	seq->tail = &item->next;
+
+	seq->count = mul_count(seq->count, count);
+	seq->max_len = add_count(seq->max_len, max_len);
+}
+
+void brace_init(struct brace_seq *seq)
+{
+	seq->head = NULL;
+	seq->tail = &seq->head;
+	seq->count = 1;
+	seq->max_len = 0;
+}
+
+void brace_add_text(struct brace_seq *seq, const char *text, size_t len, struct arena *a)
+{
+	struct brace_item *item;
+	char *copy;
+
+	if (!len)
+		return;
+
+	copy = arena_alloc(a, len);
+	memcpy(copy, text, len);
+
+	item = arena_alloc(a, sizeof(*item));
+	item->type = BRACE_TEXT;
+	item->text = copy;
+	item->len = len;
+	add_item(seq, item, 1, len);
+}
+
+static void parse(struct brace_seq *seq, const char *p, const char *end, struct arena *a);
+
+/**
+ * The '}' matching the '{' before p, or NULL.
+ */
+static const char *closing(const char *p, const char *end)
+{
+	int depth = 0;
+
+	for (; p < end; p++) {
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		else if (*p == '{')
+			depth++;
+		else if (*p == '}' && depth-- == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+/**
+ * The first comma of [p, end) outside nested braces, or NULL.
+ */
+static const char *top_comma(const char *p, const char *end)
+{
+	int depth = 0;
+
+	for (; p < end; p++) {
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		else if (*p == '{')
+			depth++;
+		else if (*p == '}')
+			depth--;
+		else if (*p == ',' && depth == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+/**
+ * Add {p,...} as a list, if [p, end) has a comma outside nested braces.
+ */
+static bool add_list(struct brace_seq *seq, const char *p, const char *end, struct arena *a)
+{
+	struct brace_item *item;
+	const char *comma;
+	size_t i, count = 0, max_len = 0;
+
+	if (!top_comma(p, end))
+		return false;
+
+	item = arena_alloc(a, sizeof(*item));
+	item->type = BRACE_LIST;
+	item->nalts = 1;
+	for (comma = p; (comma = top_comma(comma, end)); comma++)
+		item->nalts++;
+	item->alts = arena_alloc(a, item->nalts * sizeof(*item->alts));
+
+	for (i = 0; i < item->nalts; i++) {
+		comma = top_comma(p, end);
+		if (!comma)
+			comma = end;
+
+		brace_init(&item->alts[i]);
+		parse(&item->alts[i], p, comma, a);
+		count = add_count(count, item->alts[i].count);
+		if (item->alts[i].max_len > max_len)
+			max_len = item->alts[i].max_len;
+
+		p = comma + 1;
+	}
+
+	add_item(seq, item, count, max_len);
+
+	return true;
+}
+
+/**
+ * Parse a whole integer of a range; its text length is kept in *len.
+ */
+static bool range_number(const char *p, const char *end, long long *value, int *len,
+			 bool *padded)
+{
+	char number[NUMBER_SIZE];
+	const char *digits = p;
+	char *rest;
+
+	if (end - p <= 0 || end - p >= NUMBER_SIZE)
+		return false;
+
+	memcpy(number, p, end - p);
+	number[end - p] = '\0';
+
+	if (*digits == '-' || *digits == '+')
+		digits++;
+	if (!isdigit((unsigned char)*digits))
+		return false;
+
+	errno = 0;
+	*value = strtoll(number, &rest, 10);
+	if (errno || *rest)
+		return false;
+
+	*len = end - p;
+	if (*digits == '0' && end - digits > 1)
+		*padded = true;
+
+	return true;
+}
+
+/**
+ * Add {x..y} or {x..y..step} as a range, if [p, end) is one.
+ */
+static bool add_range(struct brace_seq *seq, const char *p, const char *end, struct arena *a)
+{
+	const char *dots, *step_dots = NULL, *y_end;
+	long long x, y, step = 1;
+	int x_len, y_len, step_len;
+	unsigned long long diff, ustep;
+	struct brace_item *item;
+	bool padded = false, chars;
+	char number[NUMBER_SIZE];
+	size_t max_len;
+
+	dots = memmem(p, end - p, "..", 2);
+	if (!dots)
+		return false;
+
+	y_end = end;
+	if (dots + 2 < end)
+		step_dots = memmem(dots + 2, end - dots - 2, "..", 2);
+	if (step_dots) {
+		y_end = step_dots;
+		if (!range_number(step_dots + 2, end, &step, &step_len, &padded))
+			return false;
+		padded = false;
+	}
+
+	if (range_number(p, dots, &x, &x_len, &padded)
+		&& range_number(dots + 2, y_end, &y, &y_len, &padded)) {
+		chars = false;
+	} else if (dots - p == 1 && y_end - dots == 3 && isalpha((unsigned char)*p)
+		&& isalpha((unsigned char)dots[2])) {
+		chars = true;
+		padded = false;
+		x = (unsigned char)*p;
+		y = (unsigned char)dots[2];
+	} else {
+		return false;
+	}
+
+	// the sign of the step does not matter, the direction is from x to y
+	diff = x <= y ? (unsigned long long)y - x : (unsigned long long)x - y;
+	ustep = step < 0 ? 0 - (unsigned long long)step : (unsigned long long)step;
+	if (ustep == 0)
+		ustep = 1;
+
+	item = arena_alloc(a, sizeof(*item));
+	item->type = BRACE_RANGE;
+	item->first = x;
+	item->step = (long long)(x <= y ? ustep : 0 - ustep);
+	item->n = diff / ustep < SIZE_MAX ? diff / ustep + 1 : SIZE_MAX;
+	item->chars = chars;
+	item->width = padded ? (x_len > y_len ? x_len : y_len) : 0;
+
+	// no value is longer than the widest end
+	if (chars) {
+		max_len = 1;
+	} else {
+		max_len = snprintf(number, sizeof(number), "%lld", x);
+		if ((size_t)snprintf(number, sizeof(number), "%lld", y) > max_len)
+			max_len = strlen(number);
+		if ((size_t)item->width > max_len)
+			max_len = item->width;
+	}
+
+	add_item(seq, item, item->n, max_len);
+
+	return true;
+}
+
+/**
+ * Compile the text with braces [p, end) into seq.
+ */
+static void parse(struct brace_seq *seq, const char *p, const char *end, struct arena *a)
+{
+	const char *text = p, *close;
+
+	for (; p < end; p++) {
+		if (*p == '\\' && p + 1 < end) {
+			p++;
+			continue;
+		}
+
+		if (*p != '{' || !(close = closing(p + 1, end)))
+			continue;
+
+		// the text before the braces
+		brace_add_text(seq, text, p - text, a);
+		if (add_list(seq, p + 1, close, a) || add_range(seq, p + 1, close, a)) {
+			p = close;
+			text = close + 1;
+			continue;
+		}
+
+		// not an expansion: the '{' is text, the braces inside may still be one
+		text = p;
+	}
+
+	brace_add_text(seq, text, end - text, a);
+}
+
+void brace_add_braces(struct brace_seq *seq, const char *text, struct arena *a)
+{
+	parse(seq, text, text + strlen(text), a);
+}
+
+/**
+ * Text of the value i of a range, written at buf. Returns its length.
+ */
+static size_t range_value(const struct brace_item *item, size_t i, char *buf)
+{
+	unsigned long long offset = (unsigned long long)i * (unsigned long long)item->step;
+	long long value = (long long)((unsigned long long)item->first + offset);
+
+	if (item->chars) {
+		*buf = (char)value;
+		return 1;
+	}
+
+	return sprintf(buf, "%0*lld", item->width, value);
+}
+
+static bool generate(struct generator *g, const struct brace_item *item,
+		     const struct frame *up, size_t len)
+{
+	struct frame next;
+	size_t i;
+
+	for (;;) {
+		// the end of a list alternative, go on after the list
+		while (!item && up) {
+			item = up->item;
+			up = up->up;
+		}
+
+		if (!item) {
+			g->buf[len] = '\0';
+			return g->emit(g->buf, len, g->data);
+		}
+
+		if (item->type != BRACE_TEXT)
+			break;
+
+		memcpy(g->buf + len, item->text, item->len);
+		len += item->len;
+		item = item->next;
+	}
+
+	if (item->type == BRACE_LIST) {
+		next.item = item->next;
+		next.up = up;
+		for (i = 0; i < item->nalts; i++)
+			if (!generate(g, item->alts[i].head, &next, len))
+				return false;
+		return true;
+	}
+
+	for (i = 0; i < item->n; i++)
+		if (!generate(g, item->next, up, len + range_value(item, i, g->buf + len)))
+			return false;
+
+	return true;
+}
+
+bool brace_each(const struct brace_seq *seq, brace_emit_t emit, void *data, struct arena *a)
+{
+	struct generator g;
+
+	// range_value() writes a whole number, even when it is padded
+	g.buf = arena_alloc(a, seq->max_len + NUMBER_SIZE);
+	g.emit = emit;
+	g.data = data;
+
+	return generate(&g, seq->head, NULL, 0);
+}
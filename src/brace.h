@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _BRACE_H
+#define _BRACE_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+#include "arena.h"
+
+// a word giving more strings than this is kept as it is by get_argv()
+#define BRACE_MAX_WORDS (1 << 22)
+
+// echo streams its arguments instead of building argv from this many on
+#define BRACE_STREAM_WORDS (64 * 1024)
+
+// bytes the streamed echo collects before writing them
+#define BRACE_STREAM_BATCH (64 * 1024)
+
+/*
+ * Brace expansion
+
+ * {a,b,c} stands for each of the strings between the commas, which may
+ * contain braces themselves, and {x..y[..step]} for the integers or the
+ * characters from x to y; integers with leading zeros are padded to the
+ * same width. Braces that are neither, like {a} or {}, are literal.
+
+ * A word is compiled into a sequence of items (text, list, range) and its
+ * strings are generated one at a time, in the order bash gives them, into a
+ * buffer as long as the longest one: only their number is known before,
+ * nothing is built for the whole word.
+ */
+
+struct brace_item;
+
+struct brace_seq {
+	struct brace_item *head;
+	struct brace_item **tail;
+
+	// number of strings, SIZE_MAX if it does not fit
+	size_t count;
+
+	// length of the longest string
+	size_t max_len;
+};
+
+/**
+ * Called for every string of a sequence, with the string in a buffer that
+ * is overwritten by the next one. Returns false to stop.
+ */
+typedef bool (*brace_emit_t)(const char *str, size_t len, void *data);
+
+/**
+ * Start an empty sequence, which stands for the empty string.
+ */
+void brace_init(struct brace_seq *seq);
+
+/**
+ * Append literal text to a sequence.
+ */
+void brace_add_text(struct brace_seq *seq, const char *text, size_t len, struct arena *a);
+
+/**
+ * Append text with braces to a sequence.
+ */
+void brace_add_braces(struct brace_seq *seq, const char *text, struct arena *a);
+
+/**
+ * Call emit for every string of a sequence, in order. Returns false if
+ * emit stopped.
+ */
+bool brace_each(const struct brace_seq *seq, brace_emit_t emit, void *data, struct arena *a);
+
+#endif /* _BRACE_H */
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "tree.h"
+#include "utils.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// hash buckets, twice the number of entries keeps the chains short
+#define PARSE_CACHE_BUCKETS (2 * PARSE_CACHE_ENTRIES)
+
+struct cache_entry {
+	uint64_t hash;
+	const char *line;
+	struct ctree tree;
+	struct arena arena;
+	size_t bytes;
+
+	// LRU list, the head is the most recently used entry
+	struct cache_entry *prev;
+	struct cache_entry *next;
+
+	// hash bucket chain
+	struct cache_entry *chain;
+
+	// in use by a view handed out since the last parse_cache_release()
+	bool pinned;
+	struct cache_entry *next_pinned;
+};
+
+static struct cache_entry *buckets[PARSE_CACHE_BUCKETS];
+static struct cache_entry *lru_head, *lru_tail;
+static struct parse_cache_stats stats;
+
+// pointer views handed out since the last parse_cache_release()
+static struct arena views;
+
+/*
+ * Entries whose views are in use: a command substitution parses a line
+ * while the tree of the outer line runs, and must not evict it.
+ */
+static struct cache_entry *pinned;
+
+// trees too big to be cached, kept until parse_cache_release()
+static struct cache_entry *transient;
+
+static uint64_t hash_line(const char *line)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	while (*line) {
+		hash ^= (unsigned char)*line++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static void lru_unlink(struct cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		lru_head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		lru_tail = e->prev;
+}
+
+static void lru_push(struct cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = lru_head;
+	if (lru_head)
+		lru_head->prev = e;
+	lru_head = e;
+	if (!lru_tail)
+		lru_tail = e;
+}
+
+static void evict(struct cache_entry *e)
+{
+	struct cache_entry **p = &buckets[e->hash % PARSE_CACHE_BUCKETS];
+
+	while (*p != e)
+		p = &(*p)->chain;
+	*p = e->chain;
+
+	lru_unlink(e);
+
+	stats.entries--;
+	stats.bytes -= e->bytes;
+	stats.evictions++;
+
+	arena_free(&e->arena);
+	free(e);
+}
+
+static struct cache_entry *lookup(const char *line, uint64_t hash)
+{
+	struct cache_entry *e;
+
+	for (e = buckets[hash % PARSE_CACHE_BUCKETS]; e; e = e->chain)
+		if (e->hash == hash && strcmp(e->line, line) == 0)
+			return e;
+
+	return NULL;
+}
+
+static struct cache_entry *new_entry(const char *line, uint64_t hash, command_t *root)
+{
+	struct cache_entry *e;
+
+	e = malloc(sizeof(*e));
+	DIE(e == NULL, "Error allocating cache entry.");
+
+	// the line gets a small block, the compact tree one of its exact size
+	arena_init(&e->arena, strlen(line) + 1);
+
+	e->hash = hash;
+	e->pinned = false;
+	e->line = arena_strdup(&e->arena, line);
+	ctree_pack(&e->tree, root, &e->arena);
+	e->bytes = arena_size(&e->arena);
+
+	return e;
+}
+
+static void pin(struct cache_entry *e)
+{
+	if (e->pinned)
+		return;
+
+	e->pinned = true;
+	e->next_pinned = pinned;
+	pinned = e;
+}
+
+static void insert(struct cache_entry *e)
+{
+	struct cache_entry *victim = lru_tail, *prev;
+
+	// pinned entries are skipped, the limits may be exceeded until release
+	while (victim && (stats.entries >= PARSE_CACHE_ENTRIES
+		|| stats.bytes + e->bytes > PARSE_CACHE_BYTES)) {
+		prev = victim->prev;
+		if (!victim->pinned)
+			evict(victim);
+		victim = prev;
+	}
+
+	e->chain = buckets[e->hash % PARSE_CACHE_BUCKETS];
+	buckets[e->hash % PARSE_CACHE_BUCKETS] = e;
+	lru_push(e);
+
+	stats.entries++;
+	stats.bytes += e->bytes;
+}
+
+static void free_transient(void)
+{
+	struct cache_entry *e;
+
+	while (transient) {
+		e = transient;
+		transient = e->next;
+		arena_free(&e->arena);
+		free(e);
+	}
+}
+
+bool parse_line_cached(const char *line, command_t **root)
+{
+	uint64_t hash = hash_line(line);
+	struct cache_entry *e = lookup(line, hash);
+	command_t *tree = NULL;
+
+	if (e) {
+		stats.hits++;
+		lru_unlink(e);
+		lru_push(e);
+		pin(e);
+		*root = ctree_view(&e->tree, &views);
+		return true;
+	}
+
+	stats.misses++;
+	if (!parse_line(line, &tree)) {
+		free_parse_memory();
+		return false;
+	}
+
+	// empty lines are not worth an entry
+	if (tree) {
+		e = new_entry(line, hash, tree);
+		if (e->bytes > PARSE_CACHE_MAX_TREE) {
+			e->next = transient;
+			transient = e;
+		} else {
+			insert(e);
+			pin(e);
+		}
+	}
+
+	// the parser memory goes away before the view is built, to lower the peak
+	free_parse_memory();
+	if (tree)
+		tree = ctree_view(&e->tree, &views);
+
+	*root = tree;
+	return true;
+}
+
+void parse_cache_release(void)
+{
+	struct cache_entry *e;
+
+	for (e = pinned; e; e = e->next_pinned)
+		e->pinned = false;
+	pinned = NULL;
+
+	arena_reset(&views);
+	free_transient();
+}
+
+void parse_cache_get_stats(struct parse_cache_stats *out)
+{
+	*out = stats;
+}
+
+void parse_cache_free(void)
+{
+	parse_cache_release();
+	while (lru_tail)
+		evict(lru_tail);
+
+	arena_free(&views);
+	free_transient();
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+// maximum number of parse trees kept by the cache
+#define PARSE_CACHE_ENTRIES 256
+
+// maximum memory (trees and lines) kept by the cache
+#define PARSE_CACHE_BYTES (4 * 1024 * 1024)
+
+// trees bigger than this are used once and not cached
+#define PARSE_CACHE_MAX_TREE (PARSE_CACHE_BYTES / 4)
+
+// environment variable that makes the shell print the cache counters on exit
+#define PARSE_CACHE_STATS_ENV "MINI_SHELL_STATS"
+
+struct parse_cache_stats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t entries;
+	size_t bytes;
+};
+
+/**
+ * Parse a line like parse_line(), but reuse the tree of an identical line
+ * seen before. Trees are stored in the compact layout (see tree.h) and the
+ * returned pointer view must be treated as read-only; it stays valid until
+ * parse_cache_release(), even if other lines are parsed in between (command
+ * substitution).
+ */
+bool parse_line_cached(const char *line, command_t **root);
+
+/**
+ * Release the views returned by parse_line_cached(), the counterpart of
+ * free_parse_memory() for cached trees.
+ */
+void parse_cache_release(void);
+
+/**
+ * Retrieve the hit/miss counters of the parse cache.
+ */
+void parse_cache_get_stats(struct parse_cache_stats *stats);
+
+/**
+ * Drop every cached tree.
+ */
+void parse_cache_free(void);
+
+#endif /* _CACHE_H */
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cat.h"
+#include "cmd.h"
+#include "cwd.h"
+#include "utils.h"
+
+/**
+ * Ways to move the data, tried in this order.
+ */
+enum copy_method {
+	COPY_RANGE,
+	COPY_SENDFILE,
+	COPY_SPLICE,
+	COPY_READ_WRITE
+};
+
+/**
+ * Errors of a copying system call that mean it does not handle these
+ * descriptors, the next method may.
+ */
+static bool unsupported(int error)
+{
+	return error == EINVAL || error == ENOSYS || error == EXDEV || error == EBADF
+		|| error == EOPNOTSUPP || error == ESPIPE;
+}
+
+static enum copy_method first_method(const struct stat *in, const struct stat *out)
+{
+	if (S_ISREG(in->st_mode) && S_ISREG(out->st_mode))
+		return COPY_RANGE;
+	if (S_ISREG(in->st_mode))
+		return COPY_SENDFILE;
+	if (S_ISFIFO(in->st_mode) || S_ISFIFO(out->st_mode))
+		return COPY_SPLICE;
+
+	return COPY_READ_WRITE;
+}
+
+static ssize_t move(enum copy_method m, int in, int out, char **buf)
+{
+	ssize_t n;
+
+	switch (m) {
+	case COPY_RANGE:
+		return copy_file_range(in, NULL, out, NULL, CAT_CHUNK, 0);
+	case COPY_SENDFILE:
+		return sendfile(out, in, NULL, CAT_CHUNK);
+	case COPY_SPLICE:
+		return splice(in, NULL, out, NULL, CAT_CHUNK, SPLICE_F_MOVE);
+	default:
+		break;
+	}
+
+	if (!*buf) {
+		*buf = malloc(CAT_BUFFER_SIZE);
+		DIE(*buf == NULL, "Error allocating cat buffer.");
+	}
+
+	n = read(in, *buf, CAT_BUFFER_SIZE);
+	if (n > 0 && !write_all(out, *buf, n))
+		return ERROR;
+
+	return n;
+}
+
+bool cat_copy(int in, int out)
+{
+	struct stat in_st, out_st;
+	enum copy_method m = COPY_READ_WRITE;
+	bool moved = false;
+	char *buf = NULL;
+	ssize_t n;
+
+	if (fstat(in, &in_st) == SUCCESS && fstat(out, &out_st) == SUCCESS)
+		m = first_method(&in_st, &out_st);
+
+	for (;;) {
+		n = move(m, in, out, &buf);
+		if (n > 0) {
+			moved = true;
+			continue;
+		}
+
+		// some filesystems report 0 rather than an error, the next way tells
+		if (n == 0 && (moved || m == COPY_READ_WRITE))
+			break;
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (m == COPY_READ_WRITE || !unsupported(errno)))
+			break;
+
+		// what was moved is behind the offsets, the next way goes on from there
+		m++;
+	}
+
+	free(buf);
+
+	return n == 0;
+}
+
+bool cat_accepts(char **argv)
+{
+	for (argv++; *argv; argv++)
+		if ((*argv)[0] == '-' && (*argv)[1])
+			return false;
+
+	return true;
+}
+
+/**
+ * Check whether in is the regular file out, which cat would make grow
+ * while reading it.
+ */
+static bool is_output(int in, int out)
+{
+	struct stat in_st, out_st;
+
+	return fstat(in, &in_st) == SUCCESS && fstat(out, &out_st) == SUCCESS
+		&& S_ISREG(out_st.st_mode) && in_st.st_dev == out_st.st_dev
+		&& in_st.st_ino == out_st.st_ino && out_st.st_size > 0;
+}
+
+/**
+ * Copy one input, reporting its errors on err. name is NULL for in.
+ */
+static bool cat_one(const char *name, int in, int out, int err)
+{
+	bool ok;
+	int fd = in;
+
+	if (name) {
+		fd = openat(cwd_fd(), name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			dprintf(err, "cat: %s: %s\n", name, strerror(errno));
+			return false;
+		}
+	}
+
+	if (is_output(fd, out)) {
+		dprintf(err, "cat: %s: input file is output file\n", name ? name : "-");
+		ok = false;
+	} else {
+		ok = cat_copy(fd, out);
+
+		// out has no reader anymore, like cat with SIGPIPE ignored
+		if (!ok && errno == EPIPE)
+			dprintf(err, "cat: write error: %s\n", strerror(errno));
+		else if (!ok)
+			dprintf(err, "cat: %s: %s\n", name ? name : "-", strerror(errno));
+	}
+
+	if (name)
+		DIE(close(fd) != SUCCESS, "close");
+
+	return ok;
+}
+
+int cat_run(char **argv, int in, int out, int err)
+{
+	bool ok = true;
+
+	if (!argv[1])
+		return cat_one(NULL, in, out, err) ? SUCCESS : EXIT_FAILURE;
+
+	for (argv++; *argv; argv++)
+		if (!cat_one(strcmp(*argv, "-") ? *argv : NULL, in, out, err))
+			ok = false;
+
+	return ok ? SUCCESS : EXIT_FAILURE;
+}
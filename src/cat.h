@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _CAT_H
+#define _CAT_H
+
+#include "../util/parser/parser.h"
+
+// bytes asked from copy_file_range(), sendfile() or splice() at a time
+#define CAT_CHUNK (1 << 20)
+
+// buffer of the read()/write() copy, when the kernel cannot move the data
+#define CAT_BUFFER_SIZE (128 * 1024)
+
+/*
+ * cat builtin
+
+ * cat without options runs in the shell, or in the child of its pipeline
+ * stage, without exec. The data does not go through user space when the
+ * kernel can move it: copy_file_range() from a file to a file, sendfile()
+ * from a file to anything else (a pipe, a socket), splice() when one side
+ * is a pipe. A descriptor that none of them accepts, an O_APPEND file or a
+ * terminal, is copied with read() and write().
+ */
+
+/**
+ * Check whether the builtin handles these arguments (argv[0] is "cat"):
+ * the options are left to the external cat.
+ */
+bool cat_accepts(char **argv);
+
+/**
+ * Copy the files of argv, or in if there are none ("-" is in too), to out;
+ * errors go to err. Returns the exit status of cat.
+ */
+int cat_run(char **argv, int in, int out, int err);
+
+/**
+ * Copy in to out until the end of in, with the fastest way the two
+ * descriptors allow. Returns false with errno set on failure.
+ */
+bool cat_copy(int in, int out);
+
+#endif /* _CAT_H */
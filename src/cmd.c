@@ -1,25 +1,81 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "cat.h"
 #include "cmd.h"
+#include "cwd.h"
+#include "expand.h"
+#include "fdcache.h"
+#include "meter.h"
+#include "peephole.h"
+#include "redirect.h"
 #include "utils.h"
+#include "vars.h"
 
 #define READ		0
 #define WRITE		1
 
+// argv of the simple command being run, reset for every command
+static struct arena argv_arena;
+
+// nesting of the command substitutions being run
+static int capture_depth;
+
+// the shell itself, as opposed to the children it forks to run commands
+static pid_t shell_pid;
+
+/**
+ * Process substitution started for a command that is yet to finish; fd is
+ * the end kept by the shell until the command is started.
+ */
+struct process_subst {
+	pid_t pid;
+	int fd;
+};
+
+// process substitutions of the commands being run, the nested ones on top
+static struct process_subst procs[PROCESS_SUBST_MAX];
+static int nprocs;
+
+/**
+ * Output of an echo whose arguments are streamed.
+ */
+struct echo_batch {
+	char *data;
+	size_t len;
+	size_t size;
+	bool started;
+};
+
 /**
  * Internal change-directory command.
  */
 static bool shell_cd(word_t *dir)
 {
+	char *path;
+	bool changed;
+
+	if (!dir || !dir->string)
+		return true;
+
+	path = get_word(dir);
+	changed = path && cwd_change(path);
+	free(path);
+
 	// logical short-circuiting
-	return !(dir && dir->string && chdir(dir->string) == 0);
+	return !changed;
 }
 
 /**
@@ -31,120 +87,286 @@ static int shell_exit(void)
 }
 
 /**
- * Redirect for in, out, err
+ * Internal export command: export NAME or NAME=value, for every argument.
  */
-static void do_redirect(bool act_redirect, word_t *file, int file_dest, bool append, bool in,
-						word_t *file2, int file_dest2, bool append2, int *stop)
+static int shell_export(word_t *params)
 {
-	if (!file || !file->string || *stop == 1)
-		return;
+	char *value;
 
-	int fd;
-	char *file_name = get_word(file), *file_name2 = get_word(file);
-
-	// &> redirection type
-	if (file2 && strcmp(file->string, file2->string) == 0) {
-		if (append || append2)
-			fd = open(file_name, O_CREAT | O_WRONLY | O_APPEND, COMMON_PERM);
-		else
-			fd = open(file_name2, O_CREAT | O_WRONLY | O_TRUNC, COMMON_PERM);
-
-		DIE(fd < 0, "open");
-		if (act_redirect) {
-			DIE(dup2(fd, file_dest) == ERROR, "dup2");
-			DIE(dup2(fd, file_dest2) == ERROR, "dup2");
+	for (; params; params = params->next_word) {
+		if (params->next_part && strcmp(params->next_part->string, "=") == 0) {
+			value = get_word(params->next_part->next_part);
+			vars_set(params->string, value ? value : "");
+			free(value);
 		}
-		DIE(close(fd) != SUCCESS, "close");
+		vars_export(params->string);
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Check that a word is a NAME=value assignment.
+ */
+static bool is_assignment(word_t *w)
+{
+	const char *c;
 
-		// block the following do_redirect for stderr
-		*stop = 1;
+	if (!w || w->expand || !w->next_part || w->next_part->expand
+		|| strcmp(w->next_part->string, "=") != 0)
+		return false;
+
+	if (!isalpha(*w->string) && *w->string != '_')
+		return false;
+	for (c = w->string; *c; c++)
+		if (!isalnum(*c) && *c != '_')
+			return false;
+
+	return true;
+}
 
-		free(file_name);
-		free(file_name2);
+/**
+ * Set the shell variable of a NAME=value word.
+ */
+static void assign_word(word_t *assignment)
+{
+	char *last_part = get_word(assignment->next_part->next_part);
+	char *value = last_part ? strdup(last_part) : NULL;
+	bool valueChanged = false;
 
+	// a failed expansion leaves the variable as it was
+	if (expand_failed()) {
+		free(last_part);
+		free(value);
 		return;
 	}
 
-	if (!append && !in)
-		fd = open(file_name, O_CREAT | O_WRONLY | O_TRUNC, COMMON_PERM);
-	else if (!in)
-		fd = open(file_name, O_CREAT | O_WRONLY | O_APPEND, COMMON_PERM);
-	else
-		fd = open(file_name, O_RDONLY, COMMON_PERM);
+	// searching for the second environment variable and save its value
+	if (last_part && last_part[0] == '$') {
+		free(value);
+		value = (char *)vars_get(last_part + SKIP_DOLLAR);
+		valueChanged = true;
+	}
 
-	free(file_name);
-	free(file_name2);
+	// unset variables expand to the empty string
+	vars_set(assignment->string, value ? value : "");
 
-	DIE(fd < 0, "open");
-	// redirect method
-	if (act_redirect)
-		DIE(dup2(fd, file_dest) == ERROR, "dup2");
-	DIE(close(fd) != SUCCESS, "close");
+	// last part is the result of get_word that allocates the concatenated string
+	free(last_part);
+	if (!valueChanged)
+		free(value);
 }
 
 /**
- * Parse a simple command (internal, environment variable assignment,
- * external command).
+ * Build the "NAME=value" environment entries of the prefix assignments of
+ * a command, the words of s up to cmd, in the arena.
  */
-static int parse_simple(simple_command_t *s, int level, command_t *father)
+static char **get_overlay(simple_command_t *s, word_t *cmd, size_t *n, struct arena *a)
 {
-	if (!s || !s->verb)
-		return ERROR;
+	char **entries, *entry;
+	word_t *w, *value;
+	size_t i, name_len;
 
-	word_t *verb = s->verb;
+	*n = 1;
+	for (w = s->params; w != cmd; w = w->next_word)
+		(*n)++;
 
-	if (verb->string && strncmp("cd", verb->string, strlen("cd")) == 0) {
-		int stop = 0;
+	entries = arena_alloc(a, *n * sizeof(*entries));
 
-		// minishell cd and redirect to files produce only junk files
-		do_redirect(false, s->out, STDOUT_FILENO, s->io_flags & IO_OUT_APPEND, false,
-					s->err, STDERR_FILENO, s->io_flags & IO_ERR_APPEND, &stop);
-		do_redirect(false, s->err, STDERR_FILENO, s->io_flags & IO_ERR_APPEND, false,
-					s->out, STDOUT_FILENO, s->io_flags & IO_OUT_APPEND, &stop);
+	w = s->verb;
+	for (i = 0; i < *n; i++) {
+		name_len = strlen(w->string);
+		value = w->next_part->next_part;
 
-		if (s->err) {
-			int fd = open(s->err->string, O_CREAT | O_WRONLY | O_TRUNC, COMMON_PERM);
+		entry = arena_alloc(a, name_len + word_length(value) + 2);
+		memcpy(entry, w->string, name_len);
+		entry[name_len] = '=';
+		expand_word(value, entry + name_len + 1);
+		entries[i] = entry;
 
-			DIE(fd < 0, "open");
-			DIE(close(fd) != SUCCESS, "close");
-		}
+		w = i == 0 ? s->params : w->next_word;
+	}
 
-		// negation due to the fact that returns true when a directory is changed
-		return shell_cd(s->params);
+	return entries;
+}
+
+/**
+ * Check whether a word list has a part computed at expansion time.
+ */
+static bool has_computed_part(word_t *w)
+{
+	word_t *part;
+
+	for (; w; w = w->next_word)
+		for (part = w; part; part = part->next_part)
+			if (part->expand && part->kind != EXPAND_VARIABLE
+				&& part->kind != EXPAND_GLOB && part->kind != EXPAND_BRACE)
+				return true;
+
+	return false;
+}
+
+/**
+ * Check whether echo gets so many arguments from braces that they are
+ * streamed rather than put in argv, which could be too big for exec.
+ */
+static bool is_streamed_echo(simple_command_t *s)
+{
+	word_t *w;
+
+	if (s->verb->expand || s->verb->next_part || strcmp(s->verb->string, "echo") != 0)
+		return false;
+
+	// expanded in the child, the side effects would be lost
+	if (has_computed_part(s->params))
+		return false;
+
+	for (w = s->params; w && !w->expand && !w->next_part && !strcmp(w->string, "-n");
+		 w = w->next_word)
+		;
+	// the other options are left to the external echo
+	if (w && w->string[0] == '-')
+		return false;
+
+	for (w = s->params; w; w = w->next_word)
+		if (word_is_pattern(w))
+			return false;
+
+	return count_args(s->params, &argv_arena) >= BRACE_STREAM_WORDS;
+}
+
+/**
+ * Append to the batch of a streamed echo, writing it out when it is full.
+ */
+static bool echo_put(struct echo_batch *b, const char *str, size_t len)
+{
+	if (b->len + len > b->size) {
+		if (!write_all(STDOUT_FILENO, b->data, b->len))
+			return false;
+		b->len = 0;
 	}
 
-	if (verb->string && (!strncmp("quit", verb->string, strlen("quit"))
-		|| !strncmp("exit", verb->string, strlen("exit"))))
-		return shell_exit();
+	// longer than a whole batch, written as it is
+	if (len > b->size)
+		return write_all(STDOUT_FILENO, str, len);
 
-	word_t *assignment = s->verb;
+	memcpy(b->data + b->len, str, len);
+	b->len += len;
 
-	if (assignment && assignment->next_part && assignment->next_part->next_part
-		&& strcmp(assignment->next_part->string, "=") == 0) {
-		char *last_part = get_word(assignment->next_part->next_part);
-		char *value = strdup(last_part);
-		bool valueChanged = false;
+	return true;
+}
 
-		// searching for the second environment variable and save its value
-		if (last_part[0] == '$') {
-			free(value);
-			value = getenv(last_part + SKIP_DOLLAR);
-			valueChanged = true;
-		}
+static bool echo_emit(const char *str, size_t len, void *data)
+{
+	struct echo_batch *b = data;
 
-		setenv(s->verb->string, value, DEFAULT_BEHAVIOR);
+	// like an unquoted empty word, an empty string is no argument
+	if (!len)
+		return true;
 
-		// last part is the result of get_word that allocates the concatenated string
-		free(last_part);
-		if (!valueChanged)
-			free(value);
+	if (b->started && !echo_put(b, " ", 1))
+		return false;
+	b->started = true;
 
-		return SUCCESS;
+	return echo_put(b, str, len);
+}
+
+/**
+ * echo in the child, writing its arguments in batches as they are
+ * generated. Returns the exit status.
+ */
+static int stream_echo(simple_command_t *s)
+{
+	struct echo_batch batch = { NULL, 0, BRACE_STREAM_BATCH, false };
+	bool newline = true, ok;
+	word_t *w;
+
+	for (w = s->params; w && !w->expand && !w->next_part && !strcmp(w->string, "-n");
+		 w = w->next_word)
+		newline = false;
+
+	batch.data = malloc(batch.size);
+	DIE(batch.data == NULL, "Error allocating echo buffer.");
+
+	ok = each_arg(w, echo_emit, &batch, &argv_arena)
+		&& (!newline || echo_put(&batch, "\n", 1))
+		&& write_all(STDOUT_FILENO, batch.data, batch.len);
+
+	free(batch.data);
+
+	return ok ? SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Close the ends kept by the shell for the process substitutions above mark:
+ * the command using them has them, or will not be run.
+ */
+static void process_close(int mark)
+{
+	int i;
+
+	for (i = mark; i < nprocs; i++) {
+		if (procs[i].fd != JUNK_VALUE)
+			DIE(close(procs[i].fd) != SUCCESS, "close");
+		procs[i].fd = JUNK_VALUE;
 	}
+}
 
-	// Initialize non-existent environment variables with '\0'
+/**
+ * Wait for the process substitutions above mark.
+ */
+static void process_wait(int mark)
+{
+	process_close(mark);
+
+	for (; nprocs > mark; nprocs--)
+		DIE(waitpid(procs[nprocs - 1].pid, NULL, DEFAULT_OPTIONS) == ERROR, "waitpid");
+}
+
+/**
+ * Start an external command in a child process. prefix is the command with
+ * its leading assignments, if it has any; the standard output goes to
+ * out_fd, unless it is JUNK_VALUE. Returns the pid of the child, or ERROR
+ * if an expansion or a redirection failed and the command was not started.
+ */
+static pid_t spawn_simple(simple_command_t *s, simple_command_t *prefix, int out_fd)
+{
+	// the process substitutions of this command are put above it
+	int mark = nprocs, i;
+	struct redirect_plan plan;
 	pid_t pid;
-	int status, argc;
+	int argc;
+	bool ok;
+
+	// setting the arguments, in the parent: the child only reads them; the
+	// arguments of a command are still in use while its substitutions run
+	if (!capture_depth)
+		arena_reset(&argv_arena);
+
+	// a huge echo is run in the child, without building argv
+	char **args = is_streamed_echo(s) ? NULL : get_argv(s, &argc, &argv_arena);
+
+	// prefix assignments, patched into the environment of the child only
+	char **overlay = NULL;
+	size_t noverlay = 0;
+
+	if (prefix)
+		overlay = get_overlay(prefix, s->verb, &noverlay, &argv_arena);
+
+	// files are only opened for a command that runs, in the shell: a failure
+	// costs no process; here-documents are kept by the command as parsed
+	ok = !expand_failed() && redirect_open(prefix ? prefix : s, &plan);
+	if (ok && expand_failed()) {
+		redirect_close(&plan);
+		ok = false;
+	}
+	if (!ok) {
+		process_close(mark);
+		return ERROR;
+	}
+
+	// built after the expansions, which may assign variables
+	char **envp = vars_envp();
 
 	// forking the process
 	pid = fork();
@@ -153,39 +375,304 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 		DIE(true, "fork");
 		break;
 	case CHILD:
-		;	// label error solved
-		int stop = 0;
+		// output of a command substitution, an explicit redirect still wins
+		if (out_fd != JUNK_VALUE)
+			DIE(dup2(out_fd, STDOUT_FILENO) == ERROR, "dup2");
+
+		// the /dev/fd paths in the arguments stay open across exec
+		for (i = mark; i < nprocs; i++)
+			DIE(fcntl(procs[i].fd, F_SETFD, 0) == ERROR, "fcntl");
 
-		do_redirect(true, s->in, STDIN_FILENO, false, true, NULL, JUNK_VALUE, false, &stop);
-		do_redirect(true, s->out, STDOUT_FILENO, s->io_flags & IO_OUT_APPEND, false, s->err,
-					STDERR_FILENO, s->io_flags & IO_ERR_APPEND, &stop);
-		do_redirect(true, s->err, STDERR_FILENO, s->io_flags & IO_ERR_APPEND, false, NULL,
-					JUNK_VALUE, false, &stop);
+		redirect_apply(&plan);
 
-		// setting the arguments
-		char **args = get_argv(s, &argc);
+		if (!args)
+			exit(stream_echo(s));
+
+		// execvp searches PATH and passes environ, the exported variables
+		environ = overlay ? vars_envp_overlay(overlay, noverlay) : envp;
 
 		// execute the string command
-		int result = execvp(args[0], (char *const *)args);
+		execvp(args[0], (char *const *)args);
+
+		fprintf(stderr, "Execution failed for '%s'\n", s->verb->string);
+		exit(ERROR);
+	}
+
+	// with a fan-out, the shell copies the output to the files
+	redirect_relay(&plan);
+	redirect_close(&plan);
+	process_close(mark);
+
+	return pid;
+}
+
+/**
+ * Redirections of a builtin: it writes nothing to them, they are opened for
+ * their effect on the files only. False if one of them failed, then the
+ * builtin is not run.
+ */
+static bool builtin_redirect(simple_command_t *s)
+{
+	struct redirect_plan plan;
+
+	if (!redirect_open(s, &plan))
+		return false;
+	redirect_close(&plan);
+
+	return !expand_failed();
+}
+
+/**
+ * cat in the shell, without a child, when the builtin handles its
+ * arguments. Returns its exit status, or JUNK_VALUE if the external cat
+ * has to run.
+ */
+static int builtin_cat(simple_command_t *s, simple_command_t *prefix)
+{
+	struct sigaction ignore = { .sa_handler = SIG_IGN }, old;
+	struct redirect_plan plan;
+	bool in_shell;
+	char **args;
+	int argc, ret;
+
+	if (!capture_depth)
+		arena_reset(&argv_arena);
+
+	// the computed parts are kept, the external cat gets the same arguments
+	args = get_argv(s, &argc, &argv_arena);
+	if (expand_failed())
+		return EXIT_FAILURE;
+	if (!cat_accepts(args) || redirect_fans_out(prefix ? prefix : s))
+		return JUNK_VALUE;
+
+	if (!redirect_open(prefix ? prefix : s, &plan))
+		return EXIT_FAILURE;
+	if (expand_failed()) {
+		redirect_close(&plan);
+		return EXIT_FAILURE;
+	}
+
+	// a reader that goes away ends a cat child, not the shell: there, it is
+	// a write error
+	in_shell = getpid() == shell_pid;
+	if (in_shell)
+		DIE(sigaction(SIGPIPE, &ignore, &old) != SUCCESS, "sigaction");
+
+	// the prompt must come out before the data
+	fflush(stdout);
+	ret = cat_run(args, plan.in != JUNK_VALUE ? plan.in : STDIN_FILENO,
+				  plan.out != JUNK_VALUE ? plan.out : STDOUT_FILENO,
+				  plan.err != JUNK_VALUE ? plan.err : STDERR_FILENO);
+	redirect_close(&plan);
+
+	if (in_shell)
+		DIE(sigaction(SIGPIPE, &old, NULL) != SUCCESS, "sigaction");
+
+	return ret;
+}
+
+/**
+ * pwd in the shell, printing the logical working directory it keeps.
+ * Returns its exit status, or JUNK_VALUE if the external pwd has to run for
+ * its options.
+ */
+static int builtin_pwd(simple_command_t *s, simple_command_t *prefix)
+{
+	struct redirect_plan plan;
+	const char *path = cwd_path();
+	int out;
+	bool ok;
+
+	if (s->params)
+		return JUNK_VALUE;
+
+	if (!redirect_open(prefix ? prefix : s, &plan))
+		return EXIT_FAILURE;
+	if (expand_failed()) {
+		redirect_close(&plan);
+		return EXIT_FAILURE;
+	}
+
+	// the prompt must come out before the path
+	fflush(stdout);
+	out = plan.out != JUNK_VALUE ? plan.out : STDOUT_FILENO;
+	ok = write_all(out, path, strlen(path)) && write_all(out, "\n", 1);
+	if (!ok)
+		dprintf(plan.err != JUNK_VALUE ? plan.err : STDERR_FILENO,
+				"pwd: write error: %s\n", strerror(errno));
+
+	// a path always fits in the pipe of a fan-out, it is copied afterwards
+	redirect_relay(&plan);
+	redirect_close(&plan);
+
+	return ok ? SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Run a simple command (internal, environment variable assignment,
+ * external command).
+ */
+static int run_simple(simple_command_t *s, int level, command_t *father)
+{
+	if (!s)
+		return ERROR;
+
+	simple_command_t *prefix = NULL, run;
+	word_t *cmd;
+
+	// computed parts are evaluated once per command
+	expand_reset();
+
+	// > file, >> log: the files are opened and closed, there is nothing to run
+	if (!s->verb)
+		return builtin_redirect(s) ? SUCCESS : EXIT_FAILURE;
 
-		if (result == ERROR) {
-			fprintf(stderr, "Execution failed for '%s'\n", s->verb->string);
-			exit(ERROR);
+	// NAME=value words in front of a command only go to its environment
+	if (is_assignment(s->verb)) {
+		for (cmd = s->params; cmd && is_assignment(cmd); cmd = cmd->next_word)
+			;
+
+		// a line of assignments only sets shell variables
+		if (!cmd) {
+			assign_word(s->verb);
+			for (cmd = s->params; cmd; cmd = cmd->next_word)
+				assign_word(cmd);
+			return expand_failed() ? EXIT_FAILURE : SUCCESS;
 		}
 
-		return SUCCESS;
-	default:
-		// parent process waiting for the child
-		DIE(waitpid(pid, &status, DEFAULT_OPTIONS) == ERROR, "waitpid");
+		prefix = s;
+		run = *s;
+		run.verb = cmd;
+		run.params = cmd->next_word;
+		s = &run;
+	}
 
-		// command exit code is equal to process exit code
-		if (__WIFEXITED(status))
-			return __WEXITSTATUS(status);
+	word_t *verb = s->verb;
+
+	if (verb->string && strncmp("cd", verb->string, strlen("cd")) == 0) {
+		if (!builtin_redirect(prefix ? prefix : s))
+			return EXIT_FAILURE;
+
+		// a relative path of the cache would name another file
+		fdcache_invalidate();
+
+		// negation due to the fact that returns true when a directory is changed
+		return shell_cd(s->params);
+	}
+
+	if (verb->string && (!strncmp("quit", verb->string, strlen("quit"))
+		|| !strncmp("exit", verb->string, strlen("exit")))) {
+		if (!builtin_redirect(prefix ? prefix : s))
+			return EXIT_FAILURE;
+		return shell_exit();
 	}
 
+	if (verb->string && strcmp("export", verb->string) == 0 && !verb->next_part) {
+		if (!builtin_redirect(prefix ? prefix : s))
+			return EXIT_FAILURE;
+		return shell_export(s->params);
+	}
+
+	if (!verb->expand && !verb->next_part && strcmp("pwd", verb->string) == 0) {
+		int ret = builtin_pwd(s, prefix);
+
+		if (ret != JUNK_VALUE)
+			return ret;
+	}
+
+	// in a pipeline, cat runs in the child of its stage, still without exec
+	if (!verb->expand && !verb->next_part && strcmp("cat", verb->string) == 0) {
+		int ret = builtin_cat(s, prefix);
+
+		if (ret != JUNK_VALUE)
+			return ret;
+	}
+
+	pid_t pid = spawn_simple(s, prefix, JUNK_VALUE);
+	int status;
+
+	// like bash, a command whose expansion failed is not run
+	if (pid == ERROR)
+		return EXIT_FAILURE;
+
+	// parent process waiting for the child
+	DIE(waitpid(pid, &status, DEFAULT_OPTIONS) == ERROR, "waitpid");
+
+	// command exit code is equal to process exit code
+	if (__WIFEXITED(status))
+		return __WEXITSTATUS(status);
+
 	return SUCCESS;
 }
 
+/**
+ * Parse a simple command, then wait for its process substitutions, which
+ * see the end of their input or output once it is done.
+ */
+static int parse_simple(simple_command_t *s, int level, command_t *father)
+{
+	int mark = nprocs;
+	int ret = run_simple(s, level, father);
+
+	process_wait(mark);
+
+	return ret;
+}
+
+/**
+ * Buffers of the standard output and error of one side of a &, when the
+ * output is grouped (see GROUP_OUTPUT_VAR); JUNK_VALUE when it is not.
+ */
+struct job_output {
+	int out;
+	int err;
+};
+
+static void job_open(struct job_output *job, bool grouped)
+{
+	job->out = job->err = JUNK_VALUE;
+	if (!grouped)
+		return;
+
+	job->out = memfd_create("mini-shell-job-out", MFD_CLOEXEC);
+	DIE(job->out < 0, "memfd_create");
+	job->err = memfd_create("mini-shell-job-err", MFD_CLOEXEC);
+	DIE(job->err < 0, "memfd_create");
+}
+
+/**
+ * In the child of a job, send its output to the buffers.
+ */
+static void job_redirect(const struct job_output *job)
+{
+	if (job->out == JUNK_VALUE)
+		return;
+
+	DIE(dup2(job->out, STDOUT_FILENO) == ERROR, "dup2");
+	DIE(dup2(job->err, STDERR_FILENO) == ERROR, "dup2");
+}
+
+/**
+ * Write the buffers of a finished job to the output of the shell, with the
+ * zero-copy paths of cat_copy, and release them. A reader that went away
+ * only loses the output, like it would without grouping.
+ */
+static void job_flush(struct job_output *job)
+{
+	if (job->out == JUNK_VALUE)
+		return;
+
+	// the child moved the shared offsets to the end
+	DIE(lseek(job->out, 0, SEEK_SET) != 0, "lseek");
+	DIE(lseek(job->err, 0, SEEK_SET) != 0, "lseek");
+	cat_copy(job->out, STDOUT_FILENO);
+	cat_copy(job->err, STDERR_FILENO);
+
+	DIE(close(job->out) != SUCCESS, "close");
+	DIE(close(job->err) != SUCCESS, "close");
+	job->out = job->err = JUNK_VALUE;
+}
+
 /**
  * Process two commands in parallel, by creating two children.
  */
@@ -199,20 +686,30 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
 	 *									 - initial process -> wait for cmd1, cmd2 and return
 	 */
 
-	pid_t cmd1_pid = fork();
+	const char *group = vars_get(GROUP_OUTPUT_VAR);
+	bool grouped = group && strcmp(group, "1") == 0;
+	struct job_output job1, job2;
 	int cmd1_status, cmd2_status;
 
+	// what the shell buffered must not be written again by the children
+	fflush(stdout);
+
+	job_open(&job1, grouped);
+	pid_t cmd1_pid = fork();
+
 	switch (cmd1_pid) {
 	case ERROR:
 		DIE(true, "fork");
 		break;
 	case CHILD:
+		job_redirect(&job1);
 		// the exit code of the process is the result code of parse_command
 		exit(parse_command(cmd1, level, father));
 		break;
 	}
 
 	// This code is accessed only by initial_process, the parent of cmd1_process
+	job_open(&job2, grouped);
 	pid_t cmd2_pid = fork();
 
 	switch (cmd2_pid) {
@@ -220,12 +717,16 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
 		DIE(true, "fork");
 		break;
 	case CHILD:
+		job_redirect(&job2);
 		exit(parse_command(cmd2, level, father));
 		break;
 	default:
-		// the parent of cmd2_process will wait for both processes
+		// the parent of cmd2_process will wait for both processes, the
+		// output of cmd1 comes out as soon as it is done
 		DIE(waitpid(cmd1_pid, &cmd1_status, DEFAULT_OPTIONS) == ERROR, "waitpid");
+		job_flush(&job1);
 		DIE(waitpid(cmd2_pid, &cmd2_status, DEFAULT_OPTIONS) == ERROR, "waitpid");
+		job_flush(&job2);
 	}
 
 	// both cmd1 and cmd2 result codes count to the final result code
@@ -234,17 +735,89 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
 }
 
 /**
- * Run commands by creating an anonymous pipe (cmd1 | cmd2).
+ * Capacity asked for the pipes of pipelines, from PIPE_SIZE_VAR and capped
+ * to the limit of the system, or 0 to keep the default.
+ */
+static int pipe_size(void)
+{
+	static long max_size = ERROR;
+	const char *value = vars_get(PIPE_SIZE_VAR);
+	int shift = 0;
+	char *end;
+	long size;
+	FILE *f;
+
+	if (!value || !*value)
+		return 0;
+
+	errno = 0;
+	size = strtol(value, &end, 10);
+	switch (toupper((unsigned char)*end)) {
+	case 'K':
+		shift = 10;
+		end++;
+		break;
+	case 'M':
+		shift = 20;
+		end++;
+		break;
+	case 'G':
+		shift = 30;
+		end++;
+		break;
+	default:
+		break;
+	}
+	if (errno == ERANGE || size <= 0 || *end)
+		return 0;
+
+	// read once, it only changes through sysctl
+	if (max_size == ERROR) {
+		f = fopen(PIPE_MAX_SIZE_PATH, "r");
+		if (!f || fscanf(f, "%ld", &max_size) != 1 || max_size <= 0)
+			max_size = INT_MAX;
+		if (f)
+			fclose(f);
+	}
+
+	// a size over the limit is capped, it must not overflow on the way
+	if (size > max_size >> shift)
+		return max_size;
+
+	return size << shift;
+}
+
+/**
+ * Run commands by creating an anonymous pipe (cmd1 | cmd2). In meter mode,
+ * cmd2 reads from a second pipe, fed by the shell from the first one.
  */
 static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 		command_t *father)
 {
-	// creating a pipe
-	int pipe_channel[2];
+	// creating a pipe, and the one of the relay in meter mode
+	int pipe_channel[2], relay[2] = { JUNK_VALUE, JUNK_VALUE };
+	bool metered = meter_enabled();
+	struct meter meter;
 
 	if (pipe(pipe_channel) != SUCCESS)
 		return true;
 
+	if (metered && pipe(relay) != SUCCESS) {
+		DIE(close(pipe_channel[READ]) != SUCCESS, "close");
+		DIE(close(pipe_channel[WRITE]) != SUCCESS, "close");
+		return true;
+	}
+
+	// fewer, bigger transfers between the two sides; over the limit of pipe
+	// memory of the user, the pipe keeps its default capacity
+	int size = pipe_size();
+
+	if (size) {
+		fcntl(pipe_channel[WRITE], F_SETPIPE_SZ, size);
+		if (metered)
+			fcntl(relay[WRITE], F_SETPIPE_SZ, size);
+	}
+
 	pid_t cmd1_pid = fork();
 	int cmd1_status;
 
@@ -259,6 +832,12 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 		dup2(pipe_channel[WRITE], STDOUT_FILENO);
 		DIE(close(pipe_channel[WRITE]) != SUCCESS, "close");
 
+		// a builtin runs in this child, it must not keep the relay open
+		if (metered) {
+			DIE(close(relay[READ]) != SUCCESS, "close");
+			DIE(close(relay[WRITE]) != SUCCESS, "close");
+		}
+
 		// the exit code of the process is obtained from actually running command 1
 		exit(parse_command(cmd1, level, father));
 	}
@@ -277,71 +856,388 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 	case CHILD:
 		// cmd1 output redirection mechanism to cmd2 input
 		DIE(close(pipe_channel[WRITE]) != SUCCESS, "close");
+		if (metered) {
+			DIE(close(pipe_channel[READ]) != SUCCESS, "close");
+			DIE(close(relay[WRITE]) != SUCCESS, "close");
+			pipe_channel[READ] = relay[READ];
+		}
 		dup2(pipe_channel[READ], STDIN_FILENO);
 		DIE(close(pipe_channel[READ]) != SUCCESS, "close");
 
 		exit(parse_command(cmd2, level, father));
 	}
 
-	DIE(close(pipe_channel[READ]) != SUCCESS, "close");
 	DIE(close(pipe_channel[WRITE]) != SUCCESS, "close");
 
+	if (metered) {
+		DIE(close(relay[READ]) != SUCCESS, "close");
+		meter_relay(pipe_channel[READ], relay[WRITE], &meter);
+		DIE(close(relay[WRITE]) != SUCCESS, "close");
+	}
+	DIE(close(pipe_channel[READ]) != SUCCESS, "close");
+
 	// firstly, wait for the execution of cmd1, then for the cmd2 with special input
 	DIE(waitpid(cmd1_pid, &cmd1_status, DEFAULT_OPTIONS) == ERROR, "waitpit");
 	DIE(waitpid(cmd2_pid, &cmd2_status, DEFAULT_OPTIONS) == ERROR, "waitpid");
 
+	if (metered)
+		meter_report(&meter, cmd1, cmd2);
+
 	/** only the cmd2 exit code matters, taking the negated value of the result code,
 	 * because run_on_pipe succeeds when returning false (success code)
 	 */
 	return !(__WIFEXITED(cmd2_status) && __WEXITSTATUS(cmd2_status) == SUCCESS);
 }
 
+/**
+ * Run what is left of a pipeline in a child, as its last stage would have
+ * run: a builtin there does not change the shell.
+ */
+static bool run_stage(command_t *c, int level, command_t *father)
+{
+	int status;
+	pid_t pid;
+
+	// what the shell buffered must not be written again by the child
+	fflush(stdout);
+
+	pid = fork();
+	DIE(pid == ERROR, "fork");
+	if (pid == CHILD)
+		exit(parse_command(c, level, father));
+
+	DIE(waitpid(pid, &status, DEFAULT_OPTIONS) == ERROR, "waitpid");
+
+	return !(__WIFEXITED(status) && __WEXITSTATUS(status) == SUCCESS);
+}
+
+/**
+ * Execute a node that is not evaluated by walking the tree: a simple
+ * command, or an operator whose operands run in child processes.
+ */
+static int run_node(command_t *c, int level)
+{
+	switch (c->op) {
+	case OP_NONE:
+		return parse_simple(c->scmd, level, c);
+	case OP_PARALLEL:
+		// the commands run in children, the cache cannot follow them
+		fdcache_invalidate();
+		return !run_in_parallel(c->cmd1, c->cmd2, level + 1, c);
+	case OP_PIPE:
+		fdcache_invalidate();
+
+		// the stages that only copy their input may be left out
+		c = peephole_pipeline(c);
+		if (c->op == OP_NONE)
+			return run_stage(c, level + 1, c);
+		return run_on_pipe(c->cmd1, c->cmd2, level + 1, c);
+	case OP_DUMMY:
+		return ERROR;
+	default:
+		return SHELL_EXIT;
+	}
+}
+
 /**
  * Parse and execute a command.
+ *
+ * Sequential and conditional operators are evaluated without recursion:
+ * the walk goes down the cmd1 links and back up the up links, deciding on
+ * the way up whether cmd2 runs. The C stack stays constant however deep the
+ * tree is (the grammar is left-recursive, a line of n commands is n deep).
  */
 int parse_command(command_t *c, int level, command_t *father)
 {
 	int cmd_exit = ERROR;
+	command_t *root = c, *child;
 
 	if (!c || level < 0)
 		return ERROR;
 
-	switch (c->op) {
-	case OP_NONE:
-		cmd_exit = parse_simple(c->scmd, level, father);
-		break;
-	case OP_SEQUENTIAL:
-		cmd_exit = parse_command(c->cmd1, level + 1, c);
-		cmd_exit = parse_command(c->cmd2, level + 1, c);
-		break;
+	for (;;) {
+		// go down to the leftmost node that is not a walked operator
+		while (c->op == OP_SEQUENTIAL || c->op == OP_CONDITIONAL_ZERO
+			   || c->op == OP_CONDITIONAL_NZERO)
+			c = c->cmd1;
 
-	case OP_PARALLEL:
-		cmd_exit = !run_in_parallel(c->cmd1, c->cmd2, level + 1, c);
-		break;
+		cmd_exit = run_node(c, level);
 
-	case OP_CONDITIONAL_NZERO:
-		cmd_exit = parse_command(c->cmd1, level + 1, c);
-		if (cmd_exit != SUCCESS)
-			cmd_exit = parse_command(c->cmd2, level + 1, c);
-		break;
+		// go up until a father has to run its cmd2
+		for (;;) {
+			if (c == root || cmd_exit == SHELL_EXIT)
+				return cmd_exit;
 
-	case OP_CONDITIONAL_ZERO:
-		cmd_exit = parse_command(c->cmd1, level + 1, c);
-		if (cmd_exit == SUCCESS)
-			cmd_exit = parse_command(c->cmd2, level + 1, c);
-		break;
+			child = c;
+			c = c->up;
+			if (child != c->cmd1)
+				continue;
 
-	case OP_PIPE:
-		cmd_exit = run_on_pipe(c->cmd1, c->cmd2, level + 1, c);
-		break;
+			if (c->op == OP_SEQUENTIAL
+				|| (c->op == OP_CONDITIONAL_ZERO && cmd_exit == SUCCESS)
+				|| (c->op == OP_CONDITIONAL_NZERO && cmd_exit != SUCCESS))
+				break;
+		}
 
-	case OP_DUMMY:
-		cmd_exit = ERROR;
-		break;
+		c = c->cmd2;
+	}
+}
 
-	default:
-		cmd_exit = SHELL_EXIT;
+/**
+ * Make room for n more bytes (and a terminator) in a capture buffer.
+ */
+static void capture_reserve(struct capture *out, size_t n)
+{
+	size_t size = out->size ? out->size : CAPTURE_CHUNK;
+
+	if (out->len + n + 1 <= out->size)
+		return;
+
+	while (size < out->len + n + 1)
+		size *= 2;
+
+	out->data = realloc(out->data, size);
+	DIE(out->data == NULL, "Error allocating command output.");
+	out->size = size;
+}
+
+static void capture_append(struct capture *out, const char *data, size_t len)
+{
+	capture_reserve(out, len);
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+}
+
+/**
+ * Read a pipe until its end, straight into the capture buffer.
+ */
+static void capture_read(int fd, struct capture *out)
+{
+	ssize_t n;
+
+	for (;;) {
+		capture_reserve(out, CAPTURE_CHUNK);
+		n = read(fd, out->data + out->len, out->size - out->len - 1);
+		if (n == 0)
+			return;
+		if (n < 0) {
+			DIE(errno != EINTR, "read");
+			continue;
+		}
+		out->len += n;
+	}
+}
+
+/**
+ * echo into a capture buffer; false for the options only the external
+ * echo knows (-e, -E, --help, ...).
+ */
+static bool capture_echo(simple_command_t *s, struct capture *out)
+{
+	bool newline = true;
+	char **args;
+	int argc, i;
+
+	// its arguments are expanded in the shell, they must not change it
+	if (has_computed_part(s->params))
+		return false;
+
+	expand_reset();
+	args = get_argv(s, &argc, &argv_arena);
+
+	// like the one of coreutils, --help and --version are only options alone
+	if (argc == 2 && (strcmp(args[1], "--help") == 0 || strcmp(args[1], "--version") == 0))
+		return false;
+
+	for (i = 1; i < argc && args[i][0] == '-' && args[i][1]
+		 && strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++) {
+		if (strspn(args[i] + 1, "n") != strlen(args[i] + 1))
+			return false;
+		newline = false;
+	}
+
+	for (; i < argc; i++) {
+		capture_append(out, args[i], strlen(args[i]));
+		if (i + 1 < argc)
+			capture_append(out, " ", 1);
+	}
+	if (newline)
+		capture_append(out, "\n", 1);
+
+	return true;
+}
+
+/**
+ * Check whether verb names a builtin that changes the shell, which cannot
+ * be spawned.
+ */
+static bool is_shell_builtin(const char *verb)
+{
+	return verb && (!strcmp("cd", verb) || !strcmp("quit", verb) || !strcmp("exit", verb)
+		|| !strcmp("export", verb));
+}
+
+bool changes_shell(simple_command_t *s)
+{
+	return is_assignment(s->verb)
+		|| (s->verb && !s->verb->expand && !s->verb->next_part && is_shell_builtin(s->verb->string));
+}
+
+/**
+ * Run the builtins of a command substitution in-process. A substitution is
+ * a subshell: cd, exit, export and assignments would only change the
+ * subshell, so they have nothing to do; cd still checks its directory in
+ * a child, for the error it reports. Returns false if the command has to
+ * run in a child.
+ */
+static bool capture_builtin(command_t *c, struct capture *out)
+{
+	simple_command_t *s = c->scmd;
+	const char *verb;
+	word_t *w;
+
+	if (c->op == OP_NONE && !s->verb) {
+		builtin_redirect(s);
+		return true;
+	}
+
+	if (c->op != OP_NONE || s->in || s->out || s->err)
+		return false;
+
+	if (is_assignment(s->verb)) {
+		for (w = s->params; w && is_assignment(w); w = w->next_word)
+			;
+		return !w;
+	}
+
+	if (s->verb->expand || s->verb->next_part)
+		return false;
+
+	verb = s->verb->string;
+	if (!strcmp("cd", verb))
+		return !s->params;
+	if (is_shell_builtin(verb))
+		return true;
+
+	if (!strcmp("echo", verb))
+		return capture_echo(s, out);
+
+	if (!strcmp("pwd", verb) && !s->params) {
+		capture_append(out, cwd_path(), strlen(cwd_path()));
+		capture_append(out, "\n", 1);
+		return true;
+	}
+
+	return false;
+}
+
+int capture_command(const char *line, struct capture *out)
+{
+	command_t *root;
+	int fds[2], status, ret = SUCCESS, mark = nprocs;
+	pid_t pid;
+
+	if (capture_depth >= CAPTURE_MAX_DEPTH) {
+		fprintf(stderr, "Command substitution nested too deeply\n");
+		return ERROR;
 	}
 
-	return cmd_exit;
+	// the tree stays valid until the line of the outer command is released
+	if (!parse_line_cached(line, &root))
+		return ERROR;
+	if (!root)
+		return SUCCESS;
+
+	capture_depth++;
+	if (capture_builtin(root, out)) {
+		capture_depth--;
+		return SUCCESS;
+	}
+
+	DIE(pipe2(fds, O_CLOEXEC) != SUCCESS, "pipe2");
+
+	// a lone external command is spawned like any other, without a subshell;
+	// the one of a fan-out runs in one, relaying while the output is read
+	if (root->op == OP_NONE && !is_assignment(root->scmd->verb)
+		&& !is_shell_builtin(root->scmd->verb->string) && !redirect_fans_out(root->scmd)) {
+		expand_reset();
+		pid = spawn_simple(root->scmd, NULL, fds[WRITE]);
+	} else {
+		fflush(stdout);
+		pid = fork();
+		DIE(pid == ERROR, "fork");
+		if (pid == CHILD) {
+			DIE(close(fds[READ]) != SUCCESS, "close");
+			DIE(dup2(fds[WRITE], STDOUT_FILENO) == ERROR, "dup2");
+			exit(parse_command(root, 0, NULL));
+		}
+	}
+	DIE(close(fds[WRITE]) != SUCCESS, "close");
+
+	if (pid == ERROR) {
+		ret = EXIT_FAILURE;
+	} else {
+		capture_read(fds[READ], out);
+		DIE(waitpid(pid, &status, DEFAULT_OPTIONS) == ERROR, "waitpid");
+		if (__WIFEXITED(status))
+			ret = __WEXITSTATUS(status);
+	}
+	process_wait(mark);
+	DIE(close(fds[READ]) != SUCCESS, "close");
+	capture_depth--;
+
+	return ret;
+}
+
+int process_substitute(const char *line, bool output)
+{
+	command_t *root;
+	int fds[2], end;
+	pid_t pid;
+
+	if (nprocs == PROCESS_SUBST_MAX) {
+		fprintf(stderr, "Too many process substitutions\n");
+		return ERROR;
+	}
+
+	// the substitution runs alongside the shell, it may touch the file
+	fdcache_invalidate();
+
+	// the tree stays valid until the line of the outer command is released
+	if (!parse_line_cached(line, &root))
+		return ERROR;
+
+	// the shell keeps the end the command reads (writes) through /dev/fd
+	DIE(pipe2(fds, O_CLOEXEC) != SUCCESS, "pipe2");
+	end = output ? WRITE : READ;
+
+	fflush(stdout);
+	pid = fork();
+	DIE(pid == ERROR, "fork");
+	if (pid == CHILD) {
+		// the other substitutions must see the end of their pipes, and this one
+		process_close(0);
+		DIE(close(fds[end]) != SUCCESS, "close");
+		DIE(dup2(fds[1 - end], output ? STDIN_FILENO : STDOUT_FILENO) == ERROR, "dup2");
+		exit(root ? parse_command(root, 0, NULL) : SUCCESS);
+	}
+	DIE(close(fds[1 - end]) != SUCCESS, "close");
+
+	procs[nprocs].pid = pid;
+	procs[nprocs].fd = fds[end];
+	nprocs++;
+
+	return fds[end];
+}
+
+void cmd_init(void)
+{
+	shell_pid = getpid();
+}
+
+void cmd_free(void)
+{
+	fdcache_free();
+	arena_free(&argv_arena);
+	expand_free();
 }
@@ -29,9 +29,73 @@
 
 #define SKIP_DOLLAR 1
 
+// deepest nesting of command substitutions, $(echo $(echo ...))
+#define CAPTURE_MAX_DEPTH 64
+
+// process substitutions of the commands being run at once, nested ones included
+#define PROCESS_SUBST_MAX 64
+
+// variable with the capacity of the pipes of pipelines, in bytes, with an
+// optional K, M or G suffix; unset, they keep the default of the kernel
+#define PIPE_SIZE_VAR "MINI_SHELL_PIPESIZE"
+
+// largest capacity an unprivileged process may give a pipe
+#define PIPE_MAX_SIZE_PATH "/proc/sys/fs/pipe-max-size"
+
+// variable grouping the output of parallel commands when it is "1": the
+// standard output and error of each side of a & are buffered in memfds and
+// written out whole, left side first, as the commands finish
+#define GROUP_OUTPUT_VAR "MINI_SHELL_GROUP_OUTPUT"
+
+// the capture buffer has room for at least this many bytes before a read
+#define CAPTURE_CHUNK 4096
+
+/**
+ * Growable buffer receiving the output of a command substitution.
+ */
+struct capture {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
 /**
  * Parse and execute a command.
  */
 int parse_command(command_t *cmd, int level, command_t *father);
 
+/**
+ * Check whether a simple command changes the shell when it runs there: cd,
+ * exit, quit, export, or an assignment, in front of a command too.
+ */
+bool changes_shell(simple_command_t *s);
+
+/**
+ * Run a command line with its standard output appended to the buffer
+ * (command substitution). Builtins run in-process and write straight into
+ * the buffer, other commands in a child whose output is read from a pipe.
+ * Returns the exit code of the command, or ERROR if it could not be parsed.
+ */
+int capture_command(const char *line, struct capture *out);
+
+/**
+ * Start a command line on a pipe for a process substitution: <(cmd) when
+ * output is false, its standard output is the pipe, >(cmd) when it is
+ * true, its standard input. Returns the end of the pipe for the command
+ * being expanded, which gets it as /dev/fd/N, or ERROR. The shell closes
+ * it once the command is started and waits for the substitution once the
+ * command exits.
+ */
+int process_substitute(const char *line, bool output);
+
+/**
+ * Remember the process of the shell, before it runs commands.
+ */
+void cmd_init(void);
+
+/**
+ * Release the memory kept between commands.
+ */
+void cmd_free(void);
+
 #endif /* _CMD_H */
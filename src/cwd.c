@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "cwd.h"
+#include "utils.h"
+#include "vars.h"
+
+#define CWD_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+
+// the working directory, as a logical path and as a descriptor
+static char *logical;
+static int cwd = JUNK_VALUE;
+
+void cwd_init(void)
+{
+	const char *pwd = vars_get("PWD");
+	struct stat st, pwd_st;
+
+	cwd = open(".", CWD_FLAGS);
+	DIE(cwd < 0, "open");
+	DIE(fstat(cwd, &st) != SUCCESS, "fstat");
+
+	if (pwd && *pwd == '/' && stat(pwd, &pwd_st) == SUCCESS
+		&& pwd_st.st_dev == st.st_dev && pwd_st.st_ino == st.st_ino)
+		logical = strdup(pwd);
+	else
+		logical = getcwd(NULL, 0);
+	DIE(logical == NULL, "getcwd");
+
+	vars_set("PWD", logical);
+	vars_export("PWD");
+}
+
+/**
+ * dir made absolute against the logical working directory, with its empty,
+ * . and .. components removed.
+ */
+static char *logical_path(const char *dir)
+{
+	char *path = malloc(strlen(logical) + strlen(dir) + 2), *end;
+	const char *c, *next;
+	size_t n;
+
+	DIE(path == NULL, "Error allocating path.");
+
+	// the root is kept as "", every component adds "/name"
+	if (*dir == '/' || strcmp(logical, "/") == 0)
+		path[0] = '\0';
+	else
+		strcpy(path, logical);
+	end = path + strlen(path);
+
+	for (c = dir; *c; c = next + (*next == '/')) {
+		next = c + strcspn(c, "/");
+		n = next - c;
+
+		if (n == 0 || (n == 1 && c[0] == '.'))
+			continue;
+
+		if (n == 2 && c[0] == '.' && c[1] == '.') {
+			while (end > path && *--end != '/')
+				;
+			*end = '\0';
+			continue;
+		}
+
+		*end++ = '/';
+		memcpy(end, c, n);
+		end += n;
+		*end = '\0';
+	}
+
+	if (end == path)
+		strcpy(path, "/");
+
+	return path;
+}
+
+bool cwd_change(const char *dir)
+{
+	char *path = logical_path(dir);
+	int fd = open(path, CWD_FLAGS);
+
+	if (fd < 0) {
+		free(path);
+		path = NULL;
+		fd = openat(cwd, dir, CWD_FLAGS);
+	}
+
+	// an O_PATH descriptor opens without search permission, fchdir checks it
+	if (fd < 0 || fchdir(fd) != SUCCESS) {
+		fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+		if (fd >= 0)
+			DIE(close(fd) != SUCCESS, "close");
+		free(path);
+		return false;
+	}
+
+	if (!path)
+		path = getcwd(NULL, 0);
+	DIE(path == NULL, "getcwd");
+
+	DIE(close(cwd) != SUCCESS, "close");
+	cwd = fd;
+
+	vars_set("OLDPWD", logical);
+	vars_set("PWD", path);
+	free(logical);
+	logical = path;
+
+	return true;
+}
+
+const char *cwd_path(void)
+{
+	return logical;
+}
+
+int cwd_fd(void)
+{
+	return cwd;
+}
+
+void cwd_free(void)
+{
+	if (cwd != JUNK_VALUE)
+		DIE(close(cwd) != SUCCESS, "close");
+	cwd = JUNK_VALUE;
+
+	free(logical);
+	logical = NULL;
+}
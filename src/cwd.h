@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _CWD_H
+#define _CWD_H
+
+#include "../util/parser/parser.h"
+
+/*
+ * Working directory of the shell
+
+ * Like bash, the shell keeps a logical working directory: the path cd was
+ * given, made absolute with its . and .. removed as text, so a cd through
+ * a symbolic link is remembered as it was typed. It is in PWD, and the one
+ * before the last cd in OLDPWD.
+
+ * Along with the path, the shell holds an O_PATH descriptor of the
+ * directory. The files the shell opens itself (redirections, the inputs of
+ * cat) are resolved with openat() against it, and pwd prints the path
+ * kept, without the walk up the tree getcwd() does.
+ */
+
+/**
+ * Open the working directory and set PWD. An inherited PWD is kept if it
+ * is absolute and names the directory, otherwise it is set from getcwd().
+ */
+void cwd_init(void);
+
+/**
+ * Change the working directory to dir, relative to the current one. A
+ * logical path that cannot be reached (a .. after a symbolic link to a
+ * file, say) is taken as a physical one, like bash does. Prints why and
+ * returns false if dir cannot be changed to.
+ */
+bool cwd_change(const char *dir);
+
+/**
+ * Logical path of the working directory.
+ */
+const char *cwd_path(void);
+
+/**
+ * O_PATH descriptor of the working directory, for openat() and friends.
+ */
+int cwd_fd(void);
+
+/**
+ * Close the descriptor and release the path.
+ */
+void cwd_free(void);
+
+#endif /* _CWD_H */
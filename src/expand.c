@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "arith.h"
+#include "cmd.h"
+#include "expand.h"
+#include "param.h"
+#include "utils.h"
+
+// room for "/dev/fd/" and the decimal form of a file descriptor
+#define EXPAND_FD_PATH_SIZE 20
+
+// buckets of the table of computed values, keyed by part address
+#define EXPAND_BUCKETS 256
+
+#define BUCKET(part) (((uintptr_t)(part) / sizeof(word_t)) & (EXPAND_BUCKETS - 1))
+
+struct expansion {
+	const word_t *part;
+	const char *value;
+	struct expansion *next;
+};
+
+// values of the current command
+static struct arena expand_arena;
+static struct expansion *table[EXPAND_BUCKETS];
+static size_t count;
+static bool failed;
+
+// output of the command substitutions, nested ones are stacked in it
+static struct capture capture;
+
+// nesting of the command substitutions being expanded
+static int depth;
+
+/**
+ * Output of a command substitution, without its trailing newlines.
+ */
+static const char *substitute(const word_t *part)
+{
+	size_t start = capture.len, len;
+	bool outer_failed = failed;
+	char *value;
+	int ret;
+
+	depth++;
+	ret = capture_command(part->string, &capture);
+	depth--;
+
+	// only a line that cannot be run fails the outer command
+	failed = outer_failed || ret == ERROR;
+
+	len = capture.len - start;
+	while (len && capture.data[start + len - 1] == '\n')
+		len--;
+
+	value = arena_alloc(&expand_arena, len + 1);
+	if (len)
+		memcpy(value, capture.data + start, len);
+	value[len] = '\0';
+	capture.len = start;
+
+	return value;
+}
+
+static const char *compute(const word_t *part)
+{
+	long long result;
+	char *value;
+	int fd;
+
+	switch (part->kind) {
+	case EXPAND_ARITHMETIC:
+		if (arith_eval(part->string, &result) != SUCCESS)
+			break;
+		value = arena_alloc(&expand_arena, NUMBER_SIZE);
+		snprintf(value, NUMBER_SIZE, "%lld", result);
+		return value;
+	case EXPAND_COMMAND:
+		return substitute(part);
+	case EXPAND_PARAMETER:
+		value = (char *)param_expand(part->string, &expand_arena);
+		if (!value)
+			break;
+		return value;
+	case EXPAND_PROCESS_IN:
+	case EXPAND_PROCESS_OUT:
+		fd = process_substitute(part->string, part->kind == EXPAND_PROCESS_OUT);
+		if (fd == ERROR)
+			break;
+		value = arena_alloc(&expand_arena, EXPAND_FD_PATH_SIZE);
+		snprintf(value, EXPAND_FD_PATH_SIZE, "/dev/fd/%d", fd);
+		return value;
+	default:
+		break;
+	}
+
+	failed = true;
+
+	return "";
+}
+
+const char *expand_part(const word_t *part)
+{
+	struct expansion *e;
+
+	for (e = table[BUCKET(part)]; e; e = e->next)
+		if (e->part == part)
+			return e->value;
+
+	e = arena_alloc(&expand_arena, sizeof(*e));
+	e->part = part;
+	e->value = compute(part);
+	e->next = table[BUCKET(part)];
+	table[BUCKET(part)] = e;
+	count++;
+
+	return e->value;
+}
+
+void expand_reset(void)
+{
+	// most commands have no computed part, the table is then clean already;
+	// the commands of a substitution keep the values of the outer one
+	if (count && !depth) {
+		memset(table, 0, sizeof(table));
+		arena_reset(&expand_arena);
+		count = 0;
+	}
+	failed = false;
+}
+
+bool expand_failed(void)
+{
+	return failed;
+}
+
+void expand_free(void)
+{
+	expand_reset();
+	arena_free(&expand_arena);
+
+	free(capture.data);
+	capture.data = NULL;
+	capture.len = capture.size = 0;
+}
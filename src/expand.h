@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _EXPAND_H
+#define _EXPAND_H
+
+#include "../util/parser/parser.h"
+
+/*
+ * Computed word parts
+
+ * Parts whose value is computed when the command runs (arithmetic, command and process
+ * substitution, parameter expansion, see expand_kind_t) may have side effects, $((i++)), and
+ * cost more than a variable lookup. get_argv() measures a word before writing it, so a
+ * part is reached twice: its value is computed the first time and kept,
+ * in a small table keyed by the address of the part, until the next
+ * command.
+ */
+
+/**
+ * Value of a computed part (expand == true, kind != EXPAND_VARIABLE), the
+ * empty string if its evaluation failed.
+ */
+const char *expand_part(const word_t *part);
+
+/**
+ * Forget the values of the previous command, before running a new one. The
+ * commands run by a substitution keep the values of the outer command.
+ */
+void expand_reset(void);
+
+/**
+ * Check whether a part of the current command failed to expand, in which
+ * case the command is not run.
+ */
+bool expand_failed(void);
+
+/**
+ * Release the memory kept for the computed values.
+ */
+void expand_free(void);
+
+#endif /* _EXPAND_H */
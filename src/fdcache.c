@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "cwd.h"
+#include "fdcache.h"
+#include "utils.h"
+
+// the file appended to by the previous command, fd is JUNK_VALUE if none
+static char *cached_path;
+static int cached_fd = JUNK_VALUE;
+static dev_t cached_dev;
+static ino_t cached_ino;
+
+int fdcache_append(const char *path)
+{
+	struct stat st;
+
+	if (cached_fd != JUNK_VALUE && strcmp(path, cached_path) == 0
+		&& fstatat(cwd_fd(), path, &st, 0) == SUCCESS && st.st_dev == cached_dev && st.st_ino == cached_ino)
+		return cached_fd;
+
+	fdcache_invalidate();
+
+	cached_fd = openat(cwd_fd(), path, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, COMMON_PERM);
+	if (cached_fd < 0) {
+		cached_fd = JUNK_VALUE;
+		return ERROR;
+	}
+
+	DIE(fstat(cached_fd, &st) != SUCCESS, "fstat");
+	cached_dev = st.st_dev;
+	cached_ino = st.st_ino;
+
+	cached_path = strdup(path);
+	DIE(cached_path == NULL, "Error allocating cached path.");
+
+	return cached_fd;
+}
+
+void fdcache_invalidate(void)
+{
+	if (cached_fd == JUNK_VALUE)
+		return;
+
+	DIE(close(cached_fd) != SUCCESS, "close");
+	cached_fd = JUNK_VALUE;
+
+	free(cached_path);
+	cached_path = NULL;
+}
+
+void fdcache_free(void)
+{
+	fdcache_invalidate();
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _FDCACHE_H
+#define _FDCACHE_H
+
+/*
+ * Append descriptor cache
+
+ * Scripts often append to one file line after line, echo ... >> file. The
+ * shell keeps the file of the last such command open with O_APPEND (and
+ * O_CLOEXEC), and the child of the next command appending to the same path
+ * duplicates it rather than opening the file again.
+
+ * Only consecutive appends share it: any other command may move, remove
+ * or truncate the file, and cd changes what a relative path names, so they
+ * drop the entry. A path that no longer names the inode that was opened,
+ * the file was replaced behind the shell's back, is opened again.
+ */
+
+/**
+ * Descriptor appending to path, from the cache or opened and cached now.
+ * ERROR if the file cannot be opened; the child then opens it itself and
+ * reports why.
+ */
+int fdcache_append(const char *path);
+
+/**
+ * Drop the cached descriptor, before a command that is not an append to
+ * its file.
+ */
+void fdcache_invalidate(void);
+
+/**
+ * Release the cache.
+ */
+void fdcache_free(void);
+
+#endif /* _FDCACHE_H */
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/mman.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cmd.h"
+#include "heredoc.h"
+#include "param.h"
+#include "tree.h"
+#include "utils.h"
+
+// a sealed body cannot be changed by the command, nor by anyone else
+#define HEREDOC_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+struct heredoc {
+	const simple_command_t *scmd;
+	const char *body;
+	size_t len;
+
+	// quoted delimiter, the body is not expanded
+	bool literal;
+
+	struct heredoc *next;
+};
+
+// bodies of the current line
+static struct arena heredoc_arena;
+static struct heredoc *heredocs;
+static struct heredoc **tail = &heredocs;
+
+static bool is_heredoc(command_t *c)
+{
+	return c->op == OP_NONE && (c->scmd->io_flags & IO_IN_HEREDOC);
+}
+
+bool heredoc_has(command_t *root)
+{
+	command_t *c;
+
+	for (c = root; c; c = tree_next(c, root))
+		if (is_heredoc(c))
+			return true;
+
+	return false;
+}
+
+/**
+ * Read lines up to the delimiter into h.
+ */
+static void read_body(struct heredoc *h, const char *delimiter, bool strip, FILE *stream)
+{
+	char *body = NULL, *line;
+	size_t len = 0, size = 0, n;
+	const char *text;
+
+	while ((line = read_line(stream)) != NULL) {
+		text = strip ? line + strspn(line, "\t") : line;
+		if (strcmp(text, delimiter) == 0) {
+			free(line);
+			break;
+		}
+
+		n = strlen(text);
+		if (len + n + 1 > size) {
+			size = 2 * (len + n + 1);
+			body = realloc(body, size);
+			DIE(body == NULL, "Error allocating here-document.");
+		}
+		memcpy(body + len, text, n);
+		body[len + n] = '\n';
+		len += n + 1;
+
+		free(line);
+	}
+
+	h->body = arena_alloc(&heredoc_arena, len + 1);
+	if (len)
+		memcpy((char *)h->body, body, len);
+	((char *)h->body)[len] = '\0';
+	h->len = len;
+
+	free(body);
+}
+
+/**
+ * Read the body of the here-document of s whose delimiter is word.
+ */
+static void read_heredoc(const simple_command_t *s, const char *word, FILE *stream)
+{
+	char *delimiter, *d;
+	struct heredoc *h;
+	bool strip;
+
+	strip = *word == '-';
+	word += strip;
+
+	h = arena_alloc(&heredoc_arena, sizeof(*h));
+	h->scmd = s;
+	h->literal = strpbrk(word, "'\"") != NULL;
+
+	// the delimiter without its quotes
+	delimiter = d = arena_alloc(&heredoc_arena, strlen(word) + 1);
+	for (; *word; word++)
+		if (*word != '\'' && *word != '"')
+			*d++ = *word;
+	*d = '\0';
+
+	read_body(h, delimiter, strip, stream);
+
+	h->next = NULL;
+	*tail = h;
+	tail = &h->next;
+}
+
+void heredoc_read(command_t *root, FILE *stream)
+{
+	command_t *c;
+	word_t *w;
+
+	// cmd <<A <<B has both bodies, in order
+	for (c = root; c; c = tree_next(c, root))
+		if (is_heredoc(c))
+			for (w = c->scmd->in; w; w = w->next_word)
+				read_heredoc(c->scmd, w->string, stream);
+}
+
+bool heredoc_open(simple_command_t *s, int *fd)
+{
+	const char *body = "";
+	struct heredoc *h, *last = NULL;
+	char *string = NULL;
+	size_t len = 0;
+
+	*fd = JUNK_VALUE;
+
+	if (s->io_flags & IO_IN_HERESTRING) {
+		string = get_word(s->in);
+		len = strlen(string);
+		string[len] = '\n';
+		body = string;
+		len++;
+	} else if (s->io_flags & IO_IN_HEREDOC) {
+		// the last here-document of the command is its input
+		for (h = heredocs; h; h = h->next)
+			if (h->scmd == s)
+				last = h;
+		if (last && last->literal) {
+			body = last->body;
+			len = last->len;
+		} else if (last) {
+			body = param_expand_text(last->body, &heredoc_arena);
+			if (!body)
+				return false;
+			len = strlen(body);
+		}
+	} else {
+		return true;
+	}
+
+	*fd = memfd_create("mini-shell-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	DIE(*fd < 0, "memfd_create");
+
+	DIE(!write_all(*fd, body, len), "write");
+	DIE(fcntl(*fd, F_ADD_SEALS, HEREDOC_SEALS) != SUCCESS, "fcntl");
+	DIE(lseek(*fd, 0, SEEK_SET) != 0, "lseek");
+
+	free(string);
+
+	return true;
+}
+
+void heredoc_release(void)
+{
+	if (!heredocs)
+		return;
+
+	arena_reset(&heredoc_arena);
+	heredocs = NULL;
+	tail = &heredocs;
+}
+
+void heredoc_free(void)
+{
+	heredoc_release();
+	arena_free(&heredoc_arena);
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _HEREDOC_H
+#define _HEREDOC_H
+
+#include <stdio.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Here-documents and here-strings
+
+ * cmd <<EOF takes the lines following the command line, up to a line that
+ * is EOF, as the standard input of cmd. With <<-EOF the leading tabs of
+ * these lines are removed; with a quoted delimiter, 'EOF' or "EOF", the
+ * body is used as it is, otherwise its $name and ${...} are expanded when
+ * the command runs, and a backslash only quotes $, ` and itself. A command may have several, cmd <<A <<B: all the
+ * bodies are read, in order, and the last one is the input. cmd <<<word
+ * takes the expanded word and a newline.
+
+ * The parser only keeps the delimiters (see IO_IN_HEREDOC): the shell reads
+ * the bodies after parsing a line and keeps them, by simple command, until
+ * the line is done. When a command runs, its input is written once into a
+ * sealed memfd that becomes its standard input, so there is no process to
+ * feed it, and no pipe that a big body could fill.
+ */
+
+/**
+ * Check whether a parsed line has here-documents.
+ */
+bool heredoc_has(command_t *root);
+
+/**
+ * Read the bodies of the here-documents of a parsed line from stream, in
+ * the order of the line. A body cut by the end of the input is kept.
+ */
+void heredoc_read(command_t *root, FILE *stream);
+
+/**
+ * Standard input of a command with a here-document or a here-string, in fd:
+ * a sealed memfd holding it, at offset 0, or JUNK_VALUE if the command has
+ * neither. Returns false if the expansion of the body failed.
+ */
+bool heredoc_open(simple_command_t *s, int *fd);
+
+/**
+ * Forget the bodies of the line, once it is done.
+ */
+void heredoc_release(void);
+
+/**
+ * Release all the memory kept for the here-documents.
+ */
+void heredoc_free(void);
+
+#endif /* _HEREDOC_H */
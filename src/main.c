@@ -1,15 +1,25 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../util/parser/parser.h"
+#include "arena.h"
+#include "cache.h"
 #include "cmd.h"
+#include "cwd.h"
+#include "heredoc.h"
+#include "meter.h"
+#include "peephole.h"
+#include "script.h"
+#include "uring.h"
 #include "utils.h"
+#include "vars.h"
+#include "wildcard.h"
 
 #define PROMPT             "> "
-#define CHUNK_SIZE         1024
 
 
 void parse_error(const char *str, const int where)
@@ -17,48 +27,6 @@ void parse_error(const char *str, const int where)
 	fprintf(stderr, "Parse error near %d: %s\n", where, str);
 }
 
-/**
- * Readline from mini-shell.
- */
-static char *read_line(void)
-{
-	char *line = NULL;
-	int line_length = 0;
-
-	char chunk[CHUNK_SIZE];
-	int chunk_length;
-
-	char *rc;
-
-	int endline = 0;
-
-	while (!endline) {
-		rc = fgets(chunk, CHUNK_SIZE, stdin);
-		if (rc == NULL)
-			break;
-
-		chunk_length = strlen(chunk);
-		if (chunk[chunk_length - 1] == '\n') {
-			if (chunk_length > 1 && chunk[chunk_length - 2] == '\r')
-				/* Windows */
-				chunk[chunk_length - 2] = 0;
-			else
-				chunk[chunk_length - 1] = 0;
-			endline = 1;
-		}
-
-		line = realloc(line, line_length + CHUNK_SIZE);
-		DIE(line == NULL, "Error allocating command line");
-
-		line[line_length] = '\0';
-		strcat(line, chunk);
-
-		line_length += CHUNK_SIZE;
-	}
-
-	return line;
-}
-
 static void start_shell(void)
 {
 	char *line;
@@ -72,15 +40,22 @@ static void start_shell(void)
 		ret = 0;
 
 		root = NULL;
-		line = read_line();
+		line = read_line(stdin);
 		if (line == NULL)
 			return;
-		parse_line(line, &root);
+		// the tree belongs to the parse cache, repeated lines are not parsed again
+		parse_line_cached(line, &root);
 
-		if (root != NULL)
+		// the bodies of the here-documents follow the line
+		if (root != NULL) {
+			heredoc_read(root, stdin);
 			ret = parse_command(root, 0, NULL);
+		}
 
-		free_parse_memory();
+		parse_cache_release();
+		wildcard_release();
+		heredoc_release();
+		peephole_release();
 		free(line);
 
 		if (ret == SHELL_EXIT)
@@ -88,9 +63,127 @@ static void start_shell(void)
 	}
 }
 
-int main(void)
+/**
+ * Execute a compiled script, straight from its mapping: no lexing or
+ * parsing, the prompts are the same as for the source script.
+ */
+static int run_compiled(const char *path)
 {
-	start_shell();
+	struct msc_file script;
+	struct arena views;
+	command_t *root;
+	uint32_t i;
+	int ret = 0;
+
+	if (msc_open(path, &script) != SUCCESS)
+		return EXIT_FAILURE;
+
+	arena_init(&views, ARENA_BLOCK_SIZE);
+	for (i = 0; ; i++) {
+		printf(PROMPT);
+		fflush(stdout);
+		if (i == script.nlines)
+			break;
+
+		root = msc_line_view(&script, i, &views);
+		if (root != NULL)
+			ret = parse_command(root, 0, NULL);
+
+		arena_reset(&views);
+		parse_cache_release();
+		wildcard_release();
+		peephole_release();
+		if (ret == SHELL_EXIT)
+			break;
+	}
+
+	arena_free(&views);
+	msc_close(&script);
 
 	return EXIT_SUCCESS;
 }
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [--meter] [script.msc]\n"
+			"       %s --compile script.sh -o script.msc\n", name, name);
+}
+
+/**
+ * Print the parse cache counters when asked through the environment.
+ */
+static void print_cache_stats(void)
+{
+	struct parse_cache_stats stats;
+
+	if (!getenv(PARSE_CACHE_STATS_ENV))
+		return;
+
+	parse_cache_get_stats(&stats);
+	fprintf(stderr, "parse cache: %zu hits, %zu misses, %zu evictions, %zu entries, %zu bytes\n",
+			stats.hits, stats.misses, stats.evictions, stats.entries, stats.bytes);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "compile", required_argument, NULL, 'c' },
+		{ "meter", no_argument, NULL, 'm' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *compile = NULL, *output = NULL;
+	int opt, ret = EXIT_SUCCESS;
+
+	vars_init(environ);
+
+	while ((opt = getopt_long(argc, argv, "o:", options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			compile = optarg;
+			break;
+		case 'm':
+			meter_enable();
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (compile || output) {
+		if (!compile || !output || optind != argc) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		return msc_compile(compile, output) == SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (optind + 1 < argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	cwd_init();
+	cmd_init();
+
+	if (optind < argc)
+		ret = run_compiled(argv[optind]);
+	else
+		start_shell();
+
+	print_cache_stats();
+	parse_cache_free();
+	cmd_free();
+	wildcard_free();
+	heredoc_free();
+	peephole_free();
+	cwd_free();
+	uring_free();
+	vars_free();
+
+	return ret;
+}
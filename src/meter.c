@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "meter.h"
+#include "utils.h"
+
+static bool enabled;
+
+void meter_enable(void)
+{
+	enabled = true;
+}
+
+bool meter_enabled(void)
+{
+	return enabled;
+}
+
+static double seconds(const struct timespec *from, const struct timespec *to)
+{
+	return (double)(to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/**
+ * Block until fd is ready for events, adding the time it took to wait.
+ */
+static void wait_for(int fd, short events, double *wait)
+{
+	struct pollfd p = { .fd = fd, .events = events };
+	struct timespec from, to;
+
+	DIE(clock_gettime(CLOCK_MONOTONIC, &from) != SUCCESS, "clock_gettime");
+	while (poll(&p, 1, -1) == ERROR)
+		DIE(errno != EINTR, "poll");
+	DIE(clock_gettime(CLOCK_MONOTONIC, &to) != SUCCESS, "clock_gettime");
+
+	*wait += seconds(&from, &to);
+}
+
+void meter_relay(int in, int out, struct meter *m)
+{
+	struct pollfd p = { .fd = in, .events = POLLIN };
+	struct sigaction ignore = { .sa_handler = SIG_IGN }, old;
+	ssize_t n;
+
+	memset(m, 0, sizeof(*m));
+
+	// a downstream side that exits early ends the relay, not the shell
+	DIE(sigaction(SIGPIPE, &ignore, &old) != SUCCESS, "sigaction");
+	DIE(clock_gettime(CLOCK_MONOTONIC, &m->start) != SUCCESS, "clock_gettime");
+
+	for (;;) {
+		n = splice(in, NULL, out, NULL, METER_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			m->bytes += n;
+			continue;
+		}
+		if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			break;
+		if (errno == EINTR)
+			continue;
+
+		// with data to move, it is the downstream pipe that is full
+		p.revents = 0;
+		if (poll(&p, 1, 0) > 0)
+			wait_for(out, POLLOUT, &m->downstream_wait);
+		else
+			wait_for(in, POLLIN, &m->upstream_wait);
+	}
+
+	DIE(clock_gettime(CLOCK_MONOTONIC, &m->end) != SUCCESS, "clock_gettime");
+	DIE(sigaction(SIGPIPE, &old, NULL) != SUCCESS, "sigaction");
+}
+
+/**
+ * Name of the command at one end of a side of a |: its last simple
+ * command when last is true, its first one otherwise.
+ */
+static const char *stage_name(command_t *c, bool last)
+{
+	while (c->op != OP_NONE)
+		c = last ? c->cmd2 : c->cmd1;
+
+	if (!c->scmd->verb)
+		return "redirection";
+
+	return c->scmd->verb->string;
+}
+
+void meter_report(const struct meter *m, command_t *cmd1, command_t *cmd2)
+{
+	double elapsed = seconds(&m->start, &m->end);
+
+	fprintf(stderr, "meter: %s | %s: %zu bytes in %.3f s (%.1f MB/s), waited %.3f s on %s, %.3f s on %s\n",
+			stage_name(cmd1, true), stage_name(cmd2, false), m->bytes, elapsed,
+			elapsed > 0 ? m->bytes / elapsed / 1e6 : 0.0,
+			m->upstream_wait, stage_name(cmd1, true),
+			m->downstream_wait, stage_name(cmd2, false));
+}
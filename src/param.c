@@ -0,0 +1,430 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "param.h"
+#include "utils.h"
+#include "vars.h"
+#include "wildcard.h"
+
+// no part of the value matches
+#define NO_MATCH SIZE_MAX
+
+enum replace_mode {
+	REPLACE_FIRST,
+	REPLACE_ALL,
+	REPLACE_PREFIX,
+	REPLACE_SUFFIX
+};
+
+/**
+ * What an operand is expanded for: a word keeps its backslashes for quote
+ * removal, a pattern also gets its values escaped, the text of a
+ * here-document only has \$, \` and \\ unescaped.
+ */
+enum operand_kind {
+	OPERAND_WORD,
+	OPERAND_PATTERN,
+	OPERAND_TEXT
+};
+
+/**
+ * Text being built, on the heap until it is complete.
+ */
+struct text {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static const char *evaluate(const char *expr, struct arena *a, int depth);
+
+static void text_append(struct text *t, const char *s, size_t len)
+{
+	if (t->len + len + 1 > t->size) {
+		t->size = 2 * (t->len + len + 1);
+		t->data = realloc(t->data, t->size);
+		DIE(t->data == NULL, "Error allocating expansion.");
+	}
+
+	memcpy(t->data + t->len, s, len);
+	t->len += len;
+	t->data[t->len] = '\0';
+}
+
+/**
+ * Move a complete text to the arena.
+ */
+static const char *text_finish(struct text *t, struct arena *a)
+{
+	char *s = arena_alloc(a, t->len + 1);
+
+	if (t->len)
+		memcpy(s, t->data, t->len);
+	s[t->len] = '\0';
+	free(t->data);
+
+	return s;
+}
+
+static char *copy(const char *s, size_t len, struct arena *a)
+{
+	char *c = arena_alloc(a, len + 1);
+
+	memcpy(c, s, len);
+	c[len] = '\0';
+
+	return c;
+}
+
+static const char *fail(const char *expr, const char *error)
+{
+	fprintf(stderr, "Parameter error in '${%s}': %s\n", expr, error);
+
+	return NULL;
+}
+
+static size_t name_length(const char *s)
+{
+	size_t len = 0;
+
+	if (!isalpha((unsigned char)*s) && *s != '_')
+		return 0;
+
+	while (isalnum((unsigned char)s[len]) || s[len] == '_')
+		len++;
+
+	return len;
+}
+
+/**
+ * The '}' closing the "${" before p, or NULL.
+ */
+static const char *closing(const char *p, const char *end)
+{
+	int depth = 0;
+
+	for (; p < end; p++) {
+		if (p[0] == '$' && p + 1 < end && p[1] == '{') {
+			depth++;
+			p++;
+		} else if (*p == '}' && depth-- == 0) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Operand [p, end) with its $name and ${...} expanded. In a pattern, the
+ * values are escaped to match only themselves.
+ */
+static const char *operand(const char *p, const char *end, enum operand_kind kind,
+			   struct arena *a, int depth)
+{
+	struct text t = { NULL, 0, 0 };
+	const char *value, *close;
+	size_t len;
+
+	while (p < end) {
+		if (*p == '\\' && p + 1 < end) {
+			if (kind == OPERAND_TEXT && strchr("$`\\", p[1]))
+				text_append(&t, p + 1, 1);
+			else
+				text_append(&t, p, 2);
+			p += 2;
+			continue;
+		}
+
+		if (p[0] == '$' && p + 1 < end && p[1] == '{') {
+			close = closing(p + 2, end);
+			value = close ? evaluate(copy(p + 2, close - p - 2, a), a, depth + 1) : NULL;
+			if (!value) {
+				free(t.data);
+				return NULL;
+			}
+			p = close + 1;
+		} else if (*p == '$' && (len = name_length(p + 1))) {
+			value = vars_get(copy(p + 1, len, a));
+			p += 1 + len;
+		} else {
+			text_append(&t, p++, 1);
+			continue;
+		}
+
+		for (; value && *value; value++) {
+			if (kind == OPERAND_PATTERN && strchr("*?[]\\", *value))
+				text_append(&t, "\\", 1);
+			text_append(&t, value, 1);
+		}
+	}
+
+	return text_finish(&t, a);
+}
+
+/**
+ * Check whether the len bytes of a pattern are plain text.
+ */
+static bool is_literal(const char *pattern, size_t len)
+{
+	return strcspn(pattern, "\\*?[") >= len;
+}
+
+static const char *find_last(const char *s, size_t n, const char *text, size_t len)
+{
+	size_t i;
+
+	if (len > n)
+		return NULL;
+
+	for (i = n - len + 1; i-- > 0;)
+		if (memcmp(s + i, text, len) == 0)
+			return s + i;
+
+	return NULL;
+}
+
+/**
+ * Length of the shortest (longest) prefix of v matching the pattern, or
+ * NO_MATCH.
+ */
+static size_t prefix_match(const char *v, size_t n, const char *pattern, bool longest,
+			   struct arena *a)
+{
+	const struct wildcard_matcher *m;
+	size_t len = strlen(pattern), i;
+	const char *hit;
+
+	if (is_literal(pattern, len))
+		return len <= n && memcmp(v, pattern, len) == 0 ? len : NO_MATCH;
+
+	// *text ends at the first (last) occurrence of the text
+	if (pattern[0] == '*' && is_literal(pattern + 1, len - 1)) {
+		hit = longest ? find_last(v, n, pattern + 1, len - 1)
+			: memmem(v, n, pattern + 1, len - 1);
+		return hit ? (size_t)(hit - v) + len - 1 : NO_MATCH;
+	}
+
+	m = wildcard_compile(pattern, a);
+	for (i = 0; i <= n; i++)
+		if (wildcard_match(m, v, longest ? n - i : i))
+			return longest ? n - i : i;
+
+	return NO_MATCH;
+}
+
+/**
+ * Length of the shortest (longest) suffix of v matching the pattern, or
+ * NO_MATCH.
+ */
+static size_t suffix_match(const char *v, size_t n, const char *pattern, bool longest,
+			   struct arena *a)
+{
+	const struct wildcard_matcher *m;
+	size_t len = strlen(pattern), i;
+	const char *hit;
+
+	if (is_literal(pattern, len))
+		return len <= n && memcmp(v + n - len, pattern, len) == 0 ? len : NO_MATCH;
+
+	// text* starts at the last (first) occurrence of the text
+	if (pattern[len - 1] == '*' && is_literal(pattern, len - 1)) {
+		hit = longest ? memmem(v, n, pattern, len - 1) : find_last(v, n, pattern, len - 1);
+		return hit ? n - (size_t)(hit - v) : NO_MATCH;
+	}
+
+	m = wildcard_compile(pattern, a);
+	for (i = 0; i <= n; i++)
+		if (wildcard_match(m, v + (longest ? i : n - i), longest ? n - i : i))
+			return longest ? n - i : i;
+
+	return NO_MATCH;
+}
+
+/**
+ * End of the longest non-empty match starting at v + i, or NO_MATCH.
+ */
+static size_t match_at(const char *v, size_t n, size_t i, const struct wildcard_matcher *m)
+{
+	size_t j;
+
+	for (j = n; j > i; j--)
+		if (wildcard_match(m, v + i, j - i))
+			return j;
+
+	return NO_MATCH;
+}
+
+static const char *replace(const char *v, const char *pattern, const char *repl,
+			   enum replace_mode mode, struct arena *a)
+{
+	size_t n = strlen(v), len = strlen(pattern), rlen = strlen(repl), i, j, start;
+	const struct wildcard_matcher *m = NULL;
+	struct text t = { NULL, 0, 0 };
+	const char *hit;
+
+	if (mode == REPLACE_PREFIX) {
+		j = prefix_match(v, n, pattern, true, a);
+		if (j == NO_MATCH)
+			return v;
+		text_append(&t, repl, rlen);
+		text_append(&t, v + j, n - j);
+		return text_finish(&t, a);
+	}
+
+	if (mode == REPLACE_SUFFIX) {
+		j = suffix_match(v, n, pattern, true, a);
+		if (j == NO_MATCH)
+			return v;
+		text_append(&t, v, n - j);
+		text_append(&t, repl, rlen);
+		return text_finish(&t, a);
+	}
+
+	if (!len)
+		return v;
+
+	if (!is_literal(pattern, len))
+		m = wildcard_compile(pattern, a);
+
+	for (i = start = 0; i < n;) {
+		if (!m) {
+			hit = memmem(v + i, n - i, pattern, len);
+			if (!hit)
+				break;
+			i = hit - v;
+			j = i + len;
+		} else if ((j = match_at(v, n, i, m)) == NO_MATCH) {
+			i++;
+			continue;
+		}
+
+		text_append(&t, v + start, i - start);
+		text_append(&t, repl, rlen);
+		i = start = j;
+
+		if (mode == REPLACE_FIRST)
+			break;
+	}
+	text_append(&t, v + start, n - start);
+
+	return text_finish(&t, a);
+}
+
+static const char *evaluate(const char *expr, struct arena *a, int depth)
+{
+	const char *value, *word, *pattern, *p, *q, *end = expr + strlen(expr);
+	char number[NUMBER_SIZE], *name;
+	enum replace_mode mode;
+	bool colon, set, longest;
+	size_t len, cut;
+
+	if (depth > PARAM_MAX_DEPTH)
+		return fail(expr, "expansion nested too deeply");
+
+	if (expr[0] == '#' && expr[1]) {
+		len = name_length(expr + 1);
+		if (!len || expr[1 + len])
+			return fail(expr, "bad substitution");
+		value = vars_get(copy(expr + 1, len, a));
+		snprintf(number, sizeof(number), "%zu", value ? strlen(value) : 0);
+		return arena_strdup(a, number);
+	}
+
+	len = name_length(expr);
+	if (!len)
+		return fail(expr, "bad substitution");
+	name = copy(expr, len, a);
+	value = vars_get(name);
+	p = expr + len;
+
+	// the value is copied, a later part of the command may change it
+	if (!*p)
+		return arena_strdup(a, value ? value : "");
+
+	colon = *p == ':';
+	if (colon)
+		p++;
+
+	if (*p && strchr("-=+?", *p)) {
+		set = value && (!colon || *value);
+		if (set && *p != '+')
+			return arena_strdup(a, value);
+		if (!set && *p == '+')
+			return "";
+
+		word = operand(p + 1, end, OPERAND_WORD, a, depth);
+		if (word && *p == '=')
+			vars_set(name, word);
+		if (word && *p == '?') {
+			fprintf(stderr, "%s: %s\n", name, *word ? word : "parameter null or not set");
+			return NULL;
+		}
+		return word;
+	}
+
+	if (colon)
+		return fail(expr, "bad substitution");
+
+	value = arena_strdup(a, value ? value : "");
+
+	if (*p == '#' || *p == '%') {
+		longest = p[1] == *p;
+		pattern = operand(p + 1 + longest, end, OPERAND_PATTERN, a, depth);
+		if (!pattern)
+			return NULL;
+
+		if (*p == '#') {
+			cut = prefix_match(value, strlen(value), pattern, longest, a);
+			return cut == NO_MATCH ? value : value + cut;
+		}
+
+		cut = suffix_match(value, strlen(value), pattern, longest, a);
+		if (cut != NO_MATCH)
+			((char *)value)[strlen(value) - cut] = '\0';
+		return value;
+	}
+
+	if (*p == '/') {
+		mode = REPLACE_FIRST;
+		if (p[1] == '/')
+			mode = REPLACE_ALL;
+		else if (p[1] == '#')
+			mode = REPLACE_PREFIX;
+		else if (p[1] == '%')
+			mode = REPLACE_SUFFIX;
+		p += mode == REPLACE_FIRST ? 1 : 2;
+
+		// the pattern ends at the first '/' outside of ${...}
+		for (q = p; q < end && *q != '/'; q++) {
+			if (*q == '\\' && q + 1 < end)
+				q++;
+			else if (q[0] == '$' && q + 1 < end && q[1] == '{' && closing(q + 2, end))
+				q = closing(q + 2, end);
+		}
+
+		pattern = operand(p, q, OPERAND_PATTERN, a, depth);
+		word = q < end ? operand(q + 1, end, OPERAND_WORD, a, depth) : "";
+		if (!pattern || !word)
+			return NULL;
+
+		return replace(value, pattern, word, mode, a);
+	}
+
+	return fail(expr, "bad substitution");
+}
+
+const char *param_expand(const char *expr, struct arena *a)
+{
+	return evaluate(expr, a, 0);
+}
+
+const char *param_expand_text(const char *text, struct arena *a)
+{
+	return operand(text, text + strlen(text), OPERAND_TEXT, a, 0);
+}
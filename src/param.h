@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PARAM_H
+#define _PARAM_H
+
+#include "arena.h"
+
+// nesting of ${...} inside the operands of an expansion
+#define PARAM_MAX_DEPTH 64
+
+/*
+ * Parameter expansion, ${ expr }
+
+ * ${v}			value of v
+ * ${#v}		length of the value, in bytes
+ * ${v:-w} ${v-w}	w if v is unset or empty (unset only, without ':')
+ * ${v:=w} ${v=w}	the same, assigning w to v
+ * ${v:+w} ${v+w}	w if v is set and not empty, else nothing
+ * ${v:?w} ${v?w}	fail the command with the message w if v is unset
+ * ${v#p} ${v##p}	shortest (longest) prefix matching p removed
+ * ${v%p} ${v%%p}	shortest (longest) suffix matching p removed
+ * ${v/p/r}		first longest match of p replaced by r, // for all of
+ *			them, /# and /% for a match at the start or the end
+
+ * Operands are expanded for $name and ${...}; their values match only
+ * themselves in a pattern. The common patterns, a literal text, *text and
+ * text*, are searched for directly, without compiling a matcher.
+ */
+
+/**
+ * Value of the expansion of expr, the text between "${" and "}", allocated
+ * from the arena. Prints the error and returns NULL if it is not valid.
+ */
+const char *param_expand(const char *expr, struct arena *a);
+
+/**
+ * Text of a here-document with its $name and ${...} expanded and the
+ * backslashes before $, ` and \ removed, allocated from the arena. Prints
+ * the error and returns NULL if an expansion is not valid.
+ */
+const char *param_expand_text(const char *text, struct arena *a);
+
+#endif /* _PARAM_H */
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cmd.h"
+#include "cwd.h"
+#include "peephole.h"
+#include "utils.h"
+#include "vars.h"
+
+// rewritten pipelines of the current line
+static struct arena peephole_arena;
+
+static bool is_literal(word_t *w)
+{
+	for (; w; w = w->next_part)
+		if (w->expand)
+			return false;
+
+	return true;
+}
+
+static bool has_redirect(simple_command_t *s)
+{
+	return s->in || s->out || s->err || s->io_flags != IO_REGULAR;
+}
+
+static bool is_cat(simple_command_t *s)
+{
+	return s->verb && !s->verb->expand && !s->verb->next_part
+		&& strcmp(s->verb->string, "cat") == 0 && !has_redirect(s);
+}
+
+/**
+ * Check whether a stage only copies its input to its output.
+ */
+static bool is_plain_cat(command_t *c)
+{
+	return is_cat(c->scmd) && !c->scmd->params;
+}
+
+/**
+ * File of a first stage cat file that the next stage can read instead, or
+ * NULL. The file is checked now, the way cat would find it.
+ */
+static word_t *cat_file(command_t *c)
+{
+	word_t *file = c->scmd->params;
+	struct stat st;
+	char *name;
+	bool ok;
+
+	if (!is_cat(c->scmd) || !file || file->next_word || !is_literal(file))
+		return NULL;
+
+	name = get_word(file);
+	ok = name[0] != '-' && fstatat(cwd_fd(), name, &st, 0) == SUCCESS && S_ISREG(st.st_mode)
+		&& faccessat(cwd_fd(), name, R_OK, 0) == SUCCESS;
+	free(name);
+
+	return ok ? file : NULL;
+}
+
+static command_t *new_command(operator_t op)
+{
+	command_t *c = arena_alloc(&peephole_arena, sizeof(*c));
+
+	memset(c, 0, sizeof(*c));
+	c->op = op;
+
+	return c;
+}
+
+/**
+ * Stages of a pipeline, left to right, in an array from the arena. NULL if
+ * an operand of a pipe is not a pipe or a simple command.
+ */
+static command_t **collect(command_t *c, size_t *n)
+{
+	command_t *node, **stages;
+	size_t i;
+
+	// the grammar is left-recursive, the stages hang off the cmd1 links
+	for (*n = 1, node = c; node->op == OP_PIPE; node = node->cmd1, (*n)++)
+		if (node->cmd2->op != OP_NONE)
+			return NULL;
+	if (node->op != OP_NONE)
+		return NULL;
+
+	stages = arena_alloc(&peephole_arena, *n * sizeof(*stages));
+	for (i = *n, node = c; node->op == OP_PIPE; node = node->cmd1)
+		stages[--i] = node->cmd2;
+	stages[0] = node;
+
+	return stages;
+}
+
+command_t *peephole_pipeline(command_t *c)
+{
+	const char *mode = vars_get(PEEPHOLE_VAR);
+	bool debug = mode && strcmp(mode, "debug") == 0;
+	command_t **stages, *root, *pipe;
+	simple_command_t *next;
+	word_t *file = NULL;
+	size_t n, kept, i;
+
+	if (!mode || (strcmp(mode, "1") != 0 && !debug))
+		return c;
+
+	stages = collect(c, &n);
+	if (!stages)
+		return c;
+
+	// a | cat | b, the first and the last stage stay
+	for (i = kept = 1; i < n; i++) {
+		if (i < n - 1 && is_plain_cat(stages[i])) {
+			if (debug)
+				fprintf(stderr, "peephole: removed cat, stage %zu of %zu\n", i + 1, n);
+			continue;
+		}
+		stages[kept++] = stages[i];
+	}
+
+	// cat file | b becomes b < file; alone, b would run in the shell, where
+	// cd or an assignment would change it
+	if (stages[1]->scmd->verb && !stages[1]->scmd->in
+		&& !(stages[1]->scmd->io_flags & (IO_IN_HEREDOC | IO_IN_HERESTRING))
+		&& (kept > 2 || !changes_shell(stages[1]->scmd)))
+		file = cat_file(stages[0]);
+	if (file) {
+		next = arena_alloc(&peephole_arena, sizeof(*next));
+		*next = *stages[1]->scmd;
+		next->in = file;
+		if (debug)
+			fprintf(stderr, "peephole: cat %s | %s became %s < %s\n", file->string,
+					next->verb->string, next->verb->string, file->string);
+
+		stages++;
+		kept--;
+		stages[0] = new_command(OP_NONE);
+		stages[0]->scmd = next;
+		next->up = stages[0];
+	}
+
+	if (kept == n)
+		return c;
+
+	// the stages that were not rewritten are shared with the parsed line
+	root = stages[0];
+	for (i = 1; i < kept; i++) {
+		pipe = new_command(OP_PIPE);
+		pipe->cmd1 = root;
+		pipe->cmd2 = stages[i];
+		if (i > 1 || file)
+			root->up = pipe;
+		root = pipe;
+	}
+	root->up = c->up;
+
+	return root;
+}
+
+void peephole_release(void)
+{
+	arena_reset(&peephole_arena);
+}
+
+void peephole_free(void)
+{
+	arena_free(&peephole_arena);
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PEEPHOLE_H
+#define _PEEPHOLE_H
+
+#include "../util/parser/parser.h"
+
+// variable turning the pipeline optimizer on: "1", or "debug" to also
+// print every rewrite on stderr
+#define PEEPHOLE_VAR "MINI_SHELL_PEEPHOLE"
+
+/*
+ * Pipeline peephole optimizer
+
+ * Before a pipeline runs, the stages that only copy their input to their
+ * output are taken out of it:
+ * - a cat without arguments or redirections between two stages,
+ *   a | cat | b runs as a | b
+ * - a first cat of a single file that can be read, cat file | b, runs as
+ *   b < file, if b is a simple command without an input redirection; when
+ *   b is the only stage left, it runs in a child, and it is not rewritten
+ *   if it is cd, exit, export or an assignment
+
+ * The last stage gives the status of a pipeline, it is never removed, and
+ * neither is a first cat without arguments, which reads the input of the
+ * shell. A cat of a file that cannot be read, or that is not a regular
+ * file, stays: it reports the error while the next stage still runs.
+ * The bytes that reach each remaining stage are the same.
+
+ * The parsed line is not changed, it may be run again from the parse
+ * cache when the file is gone: the rewritten pipeline is a copy, kept
+ * until the end of the line.
+ */
+
+/**
+ * Pipeline to run for c, an OP_PIPE node: c itself if the optimizer is off
+ * or nothing can be removed, a simple command if one stage is left.
+ */
+command_t *peephole_pipeline(command_t *c);
+
+/**
+ * Forget the pipelines rewritten for the line, once it is done.
+ */
+void peephole_release(void);
+
+/**
+ * Release the memory kept for the rewritten pipelines.
+ */
+void peephole_free(void);
+
+#endif /* _PEEPHOLE_H */
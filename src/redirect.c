@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "cwd.h"
+#include "fdcache.h"
+#include "heredoc.h"
+#include "redirect.h"
+#include "uring.h"
+#include "utils.h"
+
+/**
+ * Files of a command opened together, in the order of the line, by
+ * uring_open_all(); dest tells where the descriptor of each one goes.
+ */
+struct batch {
+	struct uring_open *ops;
+	int **dest;
+	size_t n;
+	size_t size;
+};
+
+static void batch_add(struct batch *b, word_t *file, int flags, int *fd)
+{
+	if (b->n == b->size) {
+		b->size = b->size ? 2 * b->size : REDIRECT_BATCH_SIZE;
+		b->ops = realloc(b->ops, b->size * sizeof(*b->ops));
+		b->dest = realloc(b->dest, b->size * sizeof(*b->dest));
+		DIE(b->ops == NULL || b->dest == NULL, "Error allocating redirections.");
+	}
+
+	b->ops[b->n] = (struct uring_open){
+		.dirfd = cwd_fd(),
+		.path = get_word(file),
+		.flags = flags | O_CLOEXEC,
+		.mode = COMMON_PERM,
+	};
+	b->dest[b->n++] = fd;
+}
+
+/**
+ * Open the files of the batch and empty it. Prints why and returns false if
+ * one cannot be opened; the ones after it are not opened either.
+ */
+static bool batch_open(struct batch *b)
+{
+	bool ok = true;
+	size_t i;
+
+	uring_open_all(b->ops, b->n);
+
+	for (i = 0; i < b->n; i++) {
+		if (b->ops[i].fd >= 0) {
+			*b->dest[i] = b->ops[i].fd;
+		} else if (ok) {
+			fprintf(stderr, "%s: %s\n", b->ops[i].path, strerror(-b->ops[i].fd));
+			ok = false;
+		}
+		free((char *)b->ops[i].path);
+	}
+	b->n = 0;
+
+	return ok;
+}
+
+/**
+ * Open the file of an append through the append cache, into fd. Prints why
+ * and returns false if it cannot be opened.
+ */
+static bool open_cached(word_t *file, int *fd)
+{
+	char *file_name = get_word(file);
+
+	// consecutive appends to one file share a descriptor
+	*fd = fdcache_append(file_name);
+	if (*fd < 0) {
+		fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+		*fd = JUNK_VALUE;
+	}
+	free(file_name);
+
+	return *fd != JUNK_VALUE;
+}
+
+static int output_flags(bool append)
+{
+	return O_CREAT | O_WRONLY | (append ? O_APPEND : O_TRUNC);
+}
+
+/**
+ * Check whether two lists of files are the same, as &> makes them.
+ */
+static bool same_files(word_t *a, word_t *b)
+{
+	for (; a && b; a = a->next_word, b = b->next_word)
+		if (strcmp(a->string, b->string) != 0)
+			return false;
+
+	return !a && !b;
+}
+
+bool redirect_fans_out(simple_command_t *s)
+{
+	return (s->out && s->out->next_word) || (s->err && s->err->next_word);
+}
+
+static void fanout_init(struct fanout *fan)
+{
+	fan->fds = NULL;
+	fan->count = 0;
+	fan->in = fan->scratch_in = fan->scratch_out = JUNK_VALUE;
+}
+
+/**
+ * Add all the files of a stream redirected more than once to the batch.
+ * Every file opens on its own, the append cache serves a single one.
+ */
+static void fanout_add(struct batch *b, word_t *files, int flags, struct fanout *fan)
+{
+	word_t *w;
+	size_t i;
+
+	for (w = files; w; w = w->next_word)
+		fan->count++;
+
+	fan->fds = malloc(fan->count * sizeof(*fan->fds));
+	DIE(fan->fds == NULL, "Error allocating redirections.");
+
+	for (w = files, i = 0; w; w = w->next_word, i++) {
+		fan->fds[i] = JUNK_VALUE;
+		batch_add(b, w, flags, &fan->fds[i]);
+	}
+}
+
+/**
+ * Once its files are open, create the pipe the command writes to instead,
+ * whose write end goes to fd, and the scratch pipe of a fan-out.
+ */
+static void fanout_pipes(struct fanout *fan, int *fd)
+{
+	int fds[2];
+
+	if (!fan->count)
+		return;
+
+	DIE(pipe2(fds, O_CLOEXEC) != SUCCESS, "pipe2");
+	fan->in = fds[0];
+	*fd = fds[1];
+
+	DIE(pipe2(fds, O_CLOEXEC) != SUCCESS, "pipe2");
+	fan->scratch_in = fds[0];
+	fan->scratch_out = fds[1];
+}
+
+bool redirect_open(simple_command_t *s, struct redirect_plan *plan)
+{
+	bool out_append = s->io_flags & IO_OUT_APPEND, err_append = s->io_flags & IO_ERR_APPEND;
+	bool both = s->out && s->err && same_files(s->out, s->err);
+	struct batch b = { NULL, NULL, 0, 0 };
+	bool ok = false;
+
+	plan->in = plan->out = plan->err = JUNK_VALUE;
+	plan->cached_out = false;
+	fanout_init(&plan->out_fan);
+	fanout_init(&plan->err_fan);
+
+	// the append cache only serves a command appending its output alone
+	if (!s->out || !out_append || both || s->out->next_word)
+		fdcache_invalidate();
+
+	if (!heredoc_open(s, &plan->in))
+		return false;
+
+	if (plan->in == JUNK_VALUE && s->in && s->in->string)
+		batch_add(&b, s->in, O_RDONLY, &plan->in);
+
+	// &> is one file for both, appended to if either asks for it
+	if (both && s->out->next_word) {
+		fanout_add(&b, s->out, output_flags(out_append || err_append), &plan->out_fan);
+	} else if (both) {
+		batch_add(&b, s->out, output_flags(out_append || err_append), &plan->out);
+	} else {
+		if (s->out && s->out->next_word) {
+			fanout_add(&b, s->out, output_flags(out_append), &plan->out_fan);
+		} else if (s->out && s->out->string && out_append) {
+			// the cache opens its file itself, after the ones before it
+			if (!batch_open(&b) || !open_cached(s->out, &plan->out))
+				goto out;
+			plan->cached_out = true;
+		} else if (s->out && s->out->string) {
+			batch_add(&b, s->out, output_flags(false), &plan->out);
+		}
+
+		if (s->err && s->err->next_word)
+			fanout_add(&b, s->err, output_flags(err_append), &plan->err_fan);
+		else if (s->err && s->err->string)
+			batch_add(&b, s->err, output_flags(err_append), &plan->err);
+	}
+
+	if (!batch_open(&b))
+		goto out;
+
+	fanout_pipes(&plan->out_fan, &plan->out);
+	fanout_pipes(&plan->err_fan, &plan->err);
+	if (both)
+		plan->err = plan->out;
+	ok = true;
+
+out:
+	free(b.ops);
+	free(b.dest);
+	if (!ok)
+		redirect_close(plan);
+
+	return ok;
+}
+
+void redirect_apply(const struct redirect_plan *plan)
+{
+	if (plan->in != JUNK_VALUE)
+		DIE(dup2(plan->in, STDIN_FILENO) == ERROR, "dup2");
+	if (plan->out != JUNK_VALUE)
+		DIE(dup2(plan->out, STDOUT_FILENO) == ERROR, "dup2");
+	if (plan->err != JUNK_VALUE)
+		DIE(dup2(plan->err, STDERR_FILENO) == ERROR, "dup2");
+}
+
+/**
+ * Drop n bytes of the pipe in, the data of a file that could not be
+ * written.
+ */
+static void fanout_discard(int in, size_t n)
+{
+	static char buf[FANOUT_CHUNK];
+	ssize_t got;
+
+	while (n) {
+		got = read(in, buf, n < sizeof(buf) ? n : sizeof(buf));
+		if (got < 0 && errno == EINTR)
+			continue;
+		DIE(got <= 0, "read");
+		n -= got;
+	}
+}
+
+/**
+ * Move n bytes from the pipe in to the file *fd. A file opened to append
+ * cannot be spliced to, it is written from a buffer. On a write error, the
+ * file is reported and closed, the rest of the bytes are dropped.
+ */
+static void fanout_move(int in, int *fd, size_t n)
+{
+	static char buf[FANOUT_CHUNK];
+	ssize_t moved, got;
+
+	while (n && *fd != JUNK_VALUE) {
+		moved = splice(in, NULL, *fd, NULL, n, SPLICE_F_MOVE);
+		if (moved < 0 && errno == EINVAL) {
+			got = read(in, buf, n < sizeof(buf) ? n : sizeof(buf));
+			DIE(got <= 0, "read");
+
+			// what was read is gone from the pipe, even if the write fails
+			n -= got;
+			moved = write_all(*fd, buf, got) ? 0 : ERROR;
+		}
+		if (moved < 0 && errno == EINTR)
+			continue;
+
+		if (moved < 0) {
+			fprintf(stderr, "write error: %s\n", strerror(errno));
+			DIE(close(*fd) != SUCCESS, "close");
+			*fd = JUNK_VALUE;
+			break;
+		}
+		n -= moved;
+	}
+
+	if (n)
+		fanout_discard(in, n);
+}
+
+/**
+ * Copy the data waiting in the pipe of a fan-out to all its files. Returns
+ * false once the command closed the pipe.
+ */
+static bool fanout_step(struct fanout *fan)
+{
+	ssize_t n = tee(fan->in, fan->scratch_out, FANOUT_CHUNK, SPLICE_F_NONBLOCK), copy;
+	size_t i;
+
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return true;
+	DIE(n < 0, "tee");
+	if (n == 0)
+		return false;
+
+	// the data stays in the pipe of the command until the last file
+	for (i = 0; i + 1 < fan->count; i++) {
+		if (i > 0) {
+			do
+				copy = tee(fan->in, fan->scratch_out, n, 0);
+			while (copy < 0 && errno == EINTR);
+			DIE(copy != n, "tee");
+		}
+		fanout_move(fan->scratch_in, &fan->fds[i], n);
+	}
+	fanout_move(fan->in, &fan->fds[fan->count - 1], n);
+
+	return true;
+}
+
+void redirect_relay(struct redirect_plan *plan)
+{
+	struct fanout *fans[2] = { &plan->out_fan, &plan->err_fan }, *polled[2];
+	struct sigaction ignore = { .sa_handler = SIG_IGN }, old;
+	struct pollfd p[2];
+	int n, i;
+
+	// the command has the write ends, the pipes end when it closes them
+	if (plan->out_fan.count) {
+		DIE(close(plan->out) != SUCCESS, "close");
+		if (plan->err == plan->out)
+			plan->err = JUNK_VALUE;
+		plan->out = JUNK_VALUE;
+	}
+	if (plan->err_fan.count) {
+		DIE(close(plan->err) != SUCCESS, "close");
+		plan->err = JUNK_VALUE;
+	}
+
+	// a file without a reader anymore is a write error, it does not end the shell
+	DIE(sigaction(SIGPIPE, &ignore, &old) != SUCCESS, "sigaction");
+
+	for (;;) {
+		for (i = n = 0; i < 2; i++) {
+			if (fans[i]->in == JUNK_VALUE)
+				continue;
+			polled[n] = fans[i];
+			p[n++] = (struct pollfd){ .fd = fans[i]->in, .events = POLLIN };
+		}
+		if (!n)
+			break;
+
+		if (poll(p, n, -1) == ERROR) {
+			DIE(errno != EINTR, "poll");
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!p[i].revents || fanout_step(polled[i]))
+				continue;
+			DIE(close(polled[i]->in) != SUCCESS, "close");
+			polled[i]->in = JUNK_VALUE;
+		}
+	}
+
+	DIE(sigaction(SIGPIPE, &old, NULL) != SUCCESS, "sigaction");
+}
+
+static void fanout_close(struct fanout *fan)
+{
+	size_t i;
+
+	for (i = 0; i < fan->count; i++)
+		if (fan->fds[i] != JUNK_VALUE)
+			DIE(close(fan->fds[i]) != SUCCESS, "close");
+	if (fan->in != JUNK_VALUE)
+		DIE(close(fan->in) != SUCCESS, "close");
+	if (fan->scratch_in != JUNK_VALUE) {
+		DIE(close(fan->scratch_in) != SUCCESS, "close");
+		DIE(close(fan->scratch_out) != SUCCESS, "close");
+	}
+
+	free(fan->fds);
+	fanout_init(fan);
+}
+
+void redirect_close(struct redirect_plan *plan)
+{
+	if (plan->in != JUNK_VALUE)
+		DIE(close(plan->in) != SUCCESS, "close");
+	if (plan->out != JUNK_VALUE && !plan->cached_out)
+		DIE(close(plan->out) != SUCCESS, "close");
+	if (plan->err != JUNK_VALUE && plan->err != plan->out)
+		DIE(close(plan->err) != SUCCESS, "close");
+
+	plan->in = plan->out = plan->err = JUNK_VALUE;
+	plan->cached_out = false;
+	fanout_close(&plan->out_fan);
+	fanout_close(&plan->err_fan);
+}
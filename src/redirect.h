@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _REDIRECT_H
+#define _REDIRECT_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+// most bytes a fan-out copies at once, the capacity of its pipes
+#define FANOUT_CHUNK (64 * 1024)
+
+// files a command opens at once before the batch has to grow
+#define REDIRECT_BATCH_SIZE 4
+
+/*
+ * Redirections
+
+ * The files of a simple command are opened by the shell, before it forks,
+ * into a plan: a descriptor for each standard stream to replace. A file
+ * that cannot be opened is reported there and then, without creating a
+ * process. The child only applies the plan with dup2(); builtins open it
+ * too, for its effect on the files, and close it.
+
+ * The files of a command are opened as one batch, through io_uring when
+ * the kernel has it (uring.h). The descriptors of a plan are close-on-exec,
+ * no other command started meanwhile inherits them. &> shares one
+ * descriptor between the output and the error, and an append may use the
+ * descriptor of the cache (fdcache.h).
+
+ * A stream redirected more than once, cmd >a >b, goes to all its files:
+ * the command writes to a pipe, and the shell copies what comes out of it
+ * to every file until the command closes it. The copies are made in the
+ * kernel: tee() duplicates the data into a scratch pipe that is spliced to
+ * a file, and the last file gets the data of the pipe itself.
+ */
+
+/**
+ * Files of a stream redirected more than once; count is 0 if it is not.
+ */
+struct fanout {
+	int *fds;
+	size_t count;
+
+	// read end of the pipe of the command, and the scratch pipe
+	int in;
+	int scratch_in;
+	int scratch_out;
+};
+
+/**
+ * Descriptors for the standard streams of a command, JUNK_VALUE for those
+ * left as they are.
+ */
+struct redirect_plan {
+	int in;
+	int out;
+	int err;
+
+	// out belongs to the append cache, it is not closed with the plan
+	bool cached_out;
+
+	// with a fan-out, out or err is the write end of its pipe
+	struct fanout out_fan;
+	struct fanout err_fan;
+};
+
+/**
+ * Check whether a command has a stream redirected more than once. Its
+ * output has to be relayed by the shell while it runs, a builtin writing it
+ * from the shell cannot be run in-process.
+ */
+bool redirect_fans_out(simple_command_t *s);
+
+/**
+ * Open the redirections of a command. On failure, prints why, closes what
+ * was opened and returns false; so does an expansion of a here-document
+ * that fails.
+ */
+bool redirect_open(simple_command_t *s, struct redirect_plan *plan);
+
+/**
+ * Put the descriptors of the plan on the standard streams, in the child.
+ */
+void redirect_apply(const struct redirect_plan *plan);
+
+/**
+ * In the shell, once the command is started: copy the streams it fans out
+ * to their files, until it closes them. Returns at once without fan-out.
+ */
+void redirect_relay(struct redirect_plan *plan);
+
+/**
+ * Close the descriptors of the plan, in the shell.
+ */
+void redirect_close(struct redirect_plan *plan);
+
+#endif /* _REDIRECT_H */
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "heredoc.h"
+#include "script.h"
+#include "utils.h"
+
+// blobs start on a 4 bytes boundary, the alignment of the pools
+#define MSC_ALIGN 4
+
+#define MSC_PAD(x) (((x) + MSC_ALIGN - 1) & ~(size_t)(MSC_ALIGN - 1))
+
+/**
+ * Write the header, the line table and the blobs of the compiled trees.
+ */
+static int msc_write(FILE *out, struct ctree *trees, uint32_t nlines)
+{
+	static const char padding[MSC_ALIGN];
+	struct msc_header header = { MSC_MAGIC, MSC_VERSION, nlines, 0 };
+	struct msc_line line;
+	size_t offset, size;
+	uint32_t i;
+
+	if (fwrite(&header, sizeof(header), 1, out) != 1)
+		return ERROR;
+
+	offset = sizeof(header) + nlines * sizeof(line);
+	for (i = 0; i < nlines; i++) {
+		if (offset > UINT32_MAX)
+			return ERROR;
+
+		line.offset = offset;
+		line.ncmds = trees[i].ncmds;
+		line.nscmds = trees[i].nscmds;
+		line.nwords = trees[i].nwords;
+		line.nstrings = trees[i].nstrings;
+		if (fwrite(&line, sizeof(line), 1, out) != 1)
+			return ERROR;
+
+		offset += MSC_PAD(ctree_size(&trees[i]));
+	}
+
+	for (i = 0; i < nlines; i++) {
+		size = ctree_size(&trees[i]);
+		if (size && fwrite(trees[i].cmds, size, 1, out) != 1)
+			return ERROR;
+		if (MSC_PAD(size) != size && fwrite(padding, MSC_PAD(size) - size, 1, out) != 1)
+			return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+int msc_compile(const char *input, const char *output)
+{
+	struct ctree *trees = NULL;
+	uint32_t nlines = 0, size = 0;
+	struct arena a;
+	command_t *root;
+	FILE *in, *out;
+	char *line;
+	int ret = SUCCESS;
+
+	in = fopen(input, "r");
+	if (!in) {
+		perror(input);
+		return ERROR;
+	}
+
+	arena_init(&a, ARENA_BLOCK_SIZE);
+	while ((line = read_line(in)) != NULL) {
+		if (nlines == size) {
+			size = size ? 2 * size : CHUNK_SIZE;
+			trees = realloc(trees, size * sizeof(*trees));
+			DIE(trees == NULL, "Error allocating compiled lines.");
+		}
+
+		root = NULL;
+		if (!parse_line(line, &root)) {
+			fprintf(stderr, "%s:%u: cannot compile line\n", input, nlines + 1);
+			free_parse_memory();
+			free(line);
+			ret = ERROR;
+			break;
+		}
+
+		// the body is in the lines that follow, not in the tree
+		if (root && heredoc_has(root)) {
+			fprintf(stderr, "%s:%u: here-documents cannot be compiled\n", input, nlines + 1);
+			free_parse_memory();
+			free(line);
+			ret = ERROR;
+			break;
+		}
+
+		memset(&trees[nlines], 0, sizeof(*trees));
+		if (root)
+			ctree_pack(&trees[nlines], root, &a);
+		nlines++;
+
+		free_parse_memory();
+		free(line);
+	}
+	fclose(in);
+
+	if (ret == SUCCESS) {
+		out = fopen(output, "w");
+		if (!out) {
+			perror(output);
+			ret = ERROR;
+		} else {
+			ret = msc_write(out, trees, nlines);
+			if (fclose(out) != SUCCESS)
+				ret = ERROR;
+			if (ret != SUCCESS)
+				fprintf(stderr, "%s: write failed\n", output);
+		}
+	}
+
+	arena_free(&a);
+	free(trees);
+
+	return ret;
+}
+
+int msc_open(const char *path, struct msc_file *f)
+{
+	const struct msc_header *header;
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return ERROR;
+	}
+
+	if (fstat(fd, &st) != SUCCESS || (size_t)st.st_size < sizeof(*header)) {
+		fprintf(stderr, "%s: not a compiled script\n", path);
+		close(fd);
+		return ERROR;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return ERROR;
+	}
+
+	f->data = data;
+	f->size = st.st_size;
+
+	header = data;
+	if (header->magic != MSC_MAGIC || header->version != MSC_VERSION
+		|| sizeof(*header) + (size_t)header->nlines * sizeof(struct msc_line) > f->size) {
+		fprintf(stderr, "%s: not a compiled script\n", path);
+		msc_close(f);
+		return ERROR;
+	}
+
+	f->nlines = header->nlines;
+	f->lines = (const struct msc_line *)(f->data + sizeof(*header));
+
+	return SUCCESS;
+}
+
+command_t *msc_line_view(struct msc_file *f, uint32_t i, struct arena *a)
+{
+	const struct msc_line *line = &f->lines[i];
+	struct ctree t;
+
+	if (line->ncmds == 0)
+		return NULL;
+
+	t.ncmds = line->ncmds;
+	t.nscmds = line->nscmds;
+	t.nwords = line->nwords;
+	t.nstrings = line->nstrings;
+
+	// the pools are used in place, straight from the mapping
+	if (line->offset % MSC_ALIGN || line->offset > f->size
+		|| ctree_size(&t) > f->size - line->offset) {
+		fprintf(stderr, "Corrupt compiled line %u\n", i + 1);
+		return NULL;
+	}
+	ctree_layout(&t, (void *)(f->data + line->offset));
+
+	if (!ctree_check(&t)) {
+		fprintf(stderr, "Corrupt compiled line %u\n", i + 1);
+		return NULL;
+	}
+
+	return ctree_view(&t, a);
+}
+
+void msc_close(struct msc_file *f)
+{
+	munmap((void *)f->data, f->size);
+	f->data = NULL;
+	f->size = 0;
+}
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../util/parser/parser.h"
+#include "arena.h"
+#include "tree.h"
+
+// "MSC1" read as a little endian number, also catches byte order mismatches
+#define MSC_MAGIC 0x3143534d
+
+#define MSC_VERSION 1
+
+/*
+ * Precompiled script (.msc) layout
+
+ * The file starts with struct msc_header, followed by one struct msc_line
+ * per script line and then by the compact trees (see tree.h) of the lines,
+ * each one a single blob: commands, simple commands, word parts, strings.
+ * Offsets are relative to the start of the file and node references are
+ * pool indices, so the file is position independent and can be executed
+ * straight from a read-only mapping.
+
+ * Empty lines are kept (ncmds == 0) so that running the compiled script
+ * prints the same prompts as feeding the source to the shell.
+ */
+
+struct msc_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nlines;
+	uint32_t reserved;
+};
+
+struct msc_line {
+	uint32_t offset;
+	uint32_t ncmds;
+	uint32_t nscmds;
+	uint32_t nwords;
+	uint32_t nstrings;
+};
+
+struct msc_file {
+	const char *data;
+	size_t size;
+	uint32_t nlines;
+	const struct msc_line *lines;
+};
+
+/**
+ * Parse every line of a script and write the compiled form to output.
+ * Returns SUCCESS or ERROR (parse or I/O errors are reported on stderr).
+ */
+int msc_compile(const char *input, const char *output);
+
+/**
+ * Map a compiled script in memory. Returns SUCCESS or ERROR.
+ */
+int msc_open(const char *path, struct msc_file *f);
+
+/**
+ * Pointer view of line i of a mapped script, built in the arena
+ * (NULL for empty lines or corrupt trees).
+ */
+command_t *msc_line_view(struct msc_file *f, uint32_t i, struct arena *a);
+
+/**
+ * Unmap a compiled script.
+ */
+void msc_close(struct msc_file *f);
+
+#endif /* _SCRIPT_H */
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tree.h"
+#include "utils.h"
+
+#define VIEW(pool, idx) ((idx) == CTREE_NIL ? NULL : &(pool)[idx])
+
+command_t *tree_next(command_t *c, command_t *root)
+{
+	if (c->op != OP_NONE)
+		return c->cmd1;
+
+	// climb until a node is the left child of its father
+	while (c != root) {
+		if (c == c->up->cmd1)
+			return c->up->cmd2;
+		c = c->up;
+	}
+
+	return NULL;
+}
+
+static void count_words(struct ctree *t, word_t *w)
+{
+	word_t *part;
+
+	for (; w; w = w->next_word)
+		for (part = w; part; part = part->next_part) {
+			t->nwords++;
+			t->nstrings += strlen(part->string) + 1;
+		}
+}
+
+static uint32_t pack_string(struct ctree *t, const char *s)
+{
+	uint32_t offset = t->nstrings;
+	size_t len = strlen(s) + 1;
+
+	memcpy(t->strings + offset, s, len);
+	t->nstrings += len;
+
+	return offset;
+}
+
+/**
+ * Store a word list; the parts of every word are consecutive in the pool.
+ */
+static uint32_t pack_words(struct ctree *t, word_t *w)
+{
+	uint32_t head = w ? t->nwords : CTREE_NIL;
+	uint32_t last_word = CTREE_NIL, idx;
+	struct ctree_word *cw;
+	word_t *part;
+
+	for (; w; w = w->next_word) {
+		if (last_word != CTREE_NIL)
+			t->words[last_word].next_word = t->nwords;
+		last_word = t->nwords;
+
+		for (part = w; part; part = part->next_part) {
+			idx = t->nwords++;
+			cw = &t->words[idx];
+			cw->string = pack_string(t, part->string);
+			if (part->expand)
+				cw->string |= CTREE_EXPAND | (uint32_t)part->kind << CTREE_KIND_SHIFT;
+			cw->next_part = part->next_part ? idx + 1 : CTREE_NIL;
+			cw->next_word = CTREE_NIL;
+		}
+	}
+
+	return head;
+}
+
+static uint32_t pack_scmd(struct ctree *t, simple_command_t *s)
+{
+	uint32_t idx = t->nscmds++;
+	struct ctree_scmd *cs = &t->scmds[idx];
+
+	cs->verb = pack_words(t, s->verb);
+	cs->params = pack_words(t, s->params);
+	cs->in = pack_words(t, s->in);
+	cs->out = pack_words(t, s->out);
+	cs->err = pack_words(t, s->err);
+	cs->io_flags = s->io_flags;
+
+	return idx;
+}
+
+void ctree_layout(struct ctree *t, void *blob)
+{
+	t->cmds = blob;
+	t->scmds = (struct ctree_scmd *)(t->cmds + t->ncmds);
+	t->words = (struct ctree_word *)(t->scmds + t->nscmds);
+	t->strings = (char *)(t->words + t->nwords);
+}
+
+void ctree_pack(struct ctree *t, command_t *root, struct arena *a)
+{
+	struct ctree_cmd *node, *father;
+	command_t *c;
+	uint32_t idx;
+
+	memset(t, 0, sizeof(*t));
+
+	// first walk sizes the pools
+	for (c = root; c; c = tree_next(c, root)) {
+		t->ncmds++;
+		if (c->op != OP_NONE)
+			continue;
+
+		t->nscmds++;
+		count_words(t, c->scmd->verb);
+		count_words(t, c->scmd->params);
+		count_words(t, c->scmd->in);
+		count_words(t, c->scmd->out);
+		count_words(t, c->scmd->err);
+	}
+
+	// string offsets share their 32 bits with the expansion flags
+	DIE(t->nstrings > CTREE_STRING_MASK, "Command line too long.");
+
+	// all the pools share one allocation, the tree is a single blob
+	ctree_layout(t, arena_alloc(a, ctree_size(t)));
+
+	// second walk fills them, the counters are reused as cursors
+	t->ncmds = t->nscmds = t->nwords = t->nstrings = 0;
+	for (c = root; c; c = tree_next(c, root)) {
+		idx = t->ncmds++;
+		c->aux = (void *)(uintptr_t)idx;
+
+		node = &t->cmds[idx];
+		node->op = c->op;
+		node->cmd1 = node->cmd2 = node->scmd = CTREE_NIL;
+
+		if (c != root) {
+			father = &t->cmds[(uintptr_t)c->up->aux];
+			if (c == c->up->cmd1)
+				father->cmd1 = idx;
+			else
+				father->cmd2 = idx;
+		}
+
+		if (c->op == OP_NONE)
+			node->scmd = pack_scmd(t, c->scmd);
+	}
+}
+
+command_t *ctree_view(const struct ctree *t, struct arena *a)
+{
+	command_t *cmds;
+	simple_command_t *scmds;
+	word_t *words;
+	const struct ctree_word *cw;
+	const struct ctree_scmd *cs;
+	const struct ctree_cmd *cc;
+	uint32_t i;
+
+	if (t->ncmds == 0)
+		return NULL;
+
+	cmds = arena_alloc(a, t->ncmds * sizeof(*cmds));
+	scmds = arena_alloc(a, t->nscmds * sizeof(*scmds));
+	words = arena_alloc(a, t->nwords * sizeof(*words));
+
+	for (i = 0; i < t->nwords; i++) {
+		cw = &t->words[i];
+		words[i].string = t->strings + (cw->string & CTREE_STRING_MASK);
+		words[i].expand = (cw->string & CTREE_EXPAND) ? true : false;
+		words[i].kind = (cw->string & CTREE_KIND_MASK) >> CTREE_KIND_SHIFT;
+		words[i].next_part = VIEW(words, cw->next_part);
+		words[i].next_word = VIEW(words, cw->next_word);
+	}
+
+	for (i = 0; i < t->nscmds; i++) {
+		cs = &t->scmds[i];
+		scmds[i].verb = VIEW(words, cs->verb);
+		scmds[i].params = VIEW(words, cs->params);
+		scmds[i].in = VIEW(words, cs->in);
+		scmds[i].out = VIEW(words, cs->out);
+		scmds[i].err = VIEW(words, cs->err);
+		scmds[i].io_flags = cs->io_flags;
+		scmds[i].aux = NULL;
+	}
+
+	// pre-order: a father is always linked before its children
+	cmds[0].up = NULL;
+	for (i = 0; i < t->ncmds; i++) {
+		cc = &t->cmds[i];
+		cmds[i].op = cc->op;
+		cmds[i].cmd1 = VIEW(cmds, cc->cmd1);
+		cmds[i].cmd2 = VIEW(cmds, cc->cmd2);
+		cmds[i].scmd = VIEW(scmds, cc->scmd);
+		cmds[i].aux = NULL;
+
+		if (cmds[i].cmd1)
+			cmds[i].cmd1->up = &cmds[i];
+		if (cmds[i].cmd2)
+			cmds[i].cmd2->up = &cmds[i];
+		if (cmds[i].scmd)
+			cmds[i].scmd->up = &cmds[i];
+	}
+
+	return cmds;
+}
+
+#define IN_POOL(idx, n) ((idx) == CTREE_NIL || (idx) < (n))
+
+// links only point forward, which rules out cycles
+#define FORWARD(idx, i, n) ((idx) == CTREE_NIL || ((idx) > (i) && (idx) < (n)))
+
+bool ctree_check(const struct ctree *t)
+{
+	const struct ctree_word *cw;
+	const struct ctree_scmd *cs;
+	const struct ctree_cmd *cc;
+	uint32_t i;
+
+	if (t->nstrings && t->strings[t->nstrings - 1] != '\0')
+		return false;
+
+	for (i = 0; i < t->nwords; i++) {
+		cw = &t->words[i];
+		if ((cw->string & CTREE_STRING_MASK) >= t->nstrings
+			|| (cw->string & CTREE_KIND_MASK) >> CTREE_KIND_SHIFT >= EXPAND_DUMMY
+			|| !FORWARD(cw->next_part, i, t->nwords) || !FORWARD(cw->next_word, i, t->nwords))
+			return false;
+	}
+
+	for (i = 0; i < t->nscmds; i++) {
+		cs = &t->scmds[i];
+		if (!IN_POOL(cs->verb, t->nwords) || !IN_POOL(cs->params, t->nwords)
+			|| !IN_POOL(cs->in, t->nwords) || !IN_POOL(cs->out, t->nwords)
+			|| !IN_POOL(cs->err, t->nwords))
+			return false;
+	}
+
+	// children always come after their father
+	for (i = 0; i < t->ncmds; i++) {
+		cc = &t->cmds[i];
+		if (cc->op == OP_NONE) {
+			if (cc->scmd >= t->nscmds || cc->cmd1 != CTREE_NIL || cc->cmd2 != CTREE_NIL)
+				return false;
+		} else if (cc->op >= OP_DUMMY || cc->cmd1 <= i || cc->cmd1 >= t->ncmds
+			|| cc->cmd2 <= i || cc->cmd2 >= t->ncmds || cc->scmd != CTREE_NIL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t ctree_size(const struct ctree *t)
+{
+	return t->ncmds * sizeof(*t->cmds) + t->nscmds * sizeof(*t->scmds)
+		+ t->nwords * sizeof(*t->words) + t->nstrings;
+}
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _TREE_H
+#define _TREE_H
+
+#include <stdint.h>
+
+#include "../util/parser/parser.h"
+#include "arena.h"
+
+// index used for a missing node (NULL pointer in the parser structures)
+#define CTREE_NIL UINT32_MAX
+
+// set in ctree_word.string for parts that need expansion
+#define CTREE_EXPAND 0x80000000u
+
+// expansion kind (expand_kind_t) of a word part, in ctree_word.string
+#define CTREE_KIND_SHIFT 28
+#define CTREE_KIND_MASK 0x70000000u
+
+// mask extracting the string table offset of a word part
+#define CTREE_STRING_MASK 0x0fffffffu
+
+/*
+ * Compact, index based parse tree.
+
+ * Every node kind lives in its own contiguous pool and refers to other
+ * nodes by 32-bit index instead of pointer; strings are offsets into a
+ * single string table. Commands are numbered in pre-order (the root is
+ * node 0) and the parts of a word list are stored one after the other,
+ * so walking the tree reads the pools sequentially.
+
+ * A word part takes 12 bytes instead of 32, a command 16 instead of 48
+ * and a simple command 24 instead of 64.
+ */
+
+struct ctree_word {
+	uint32_t string;
+	uint32_t next_part;
+	uint32_t next_word;
+};
+
+struct ctree_scmd {
+	uint32_t verb;
+	uint32_t params;
+	uint32_t in;
+	uint32_t out;
+	uint32_t err;
+	int32_t io_flags;
+};
+
+struct ctree_cmd {
+	uint32_t op;
+	uint32_t cmd1;
+	uint32_t cmd2;
+	uint32_t scmd;
+};
+
+struct ctree {
+	struct ctree_cmd *cmds;
+	struct ctree_scmd *scmds;
+	struct ctree_word *words;
+	char *strings;
+
+	uint32_t ncmds;
+	uint32_t nscmds;
+	uint32_t nwords;
+	uint32_t nstrings;
+};
+
+/**
+ * Pack a parser tree in the compact layout, with all the pools allocated
+ * from the arena. The aux field of the commands is used as scratch space.
+ */
+void ctree_pack(struct ctree *t, command_t *root, struct arena *a);
+
+/**
+ * Point the pools of a tree whose node counts are set into blob, a single
+ * block of ctree_size() bytes.
+ */
+void ctree_layout(struct ctree *t, void *blob);
+
+/**
+ * Build the pointer view (command_t, simple_command_t, word_t) of a compact
+ * tree. The view nodes are allocated as contiguous arrays from the arena
+ * and the strings point straight into the string table.
+ */
+command_t *ctree_view(const struct ctree *t, struct arena *a);
+
+/**
+ * Check that every index and string offset of a compact tree is in range,
+ * for trees that come from outside the shell. Returns true if it is valid.
+ */
+bool ctree_check(const struct ctree *t);
+
+/**
+ * Bytes used by the pools of a compact tree.
+ */
+size_t ctree_size(const struct ctree *t);
+
+/**
+ * Next command of a pre-order walk of the tree rooted at root (NULL at the
+ * end). It follows the up links, so it needs no stack however deep the
+ * tree is.
+ */
+command_t *tree_next(command_t *c, command_t *root);
+
+#endif /* _TREE_H */
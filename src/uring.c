@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "uring.h"
+#include "utils.h"
+#include "vars.h"
+
+/**
+ * The queues of the ring, as mapped from the kernel.
+ */
+struct ring {
+	int fd;
+
+	// process the ring was set up by, a child sets up its own
+	pid_t owner;
+
+	void *sq_map;
+	size_t sq_map_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_map;
+	size_t cq_map_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static struct ring ring = { .fd = JUNK_VALUE };
+
+// the kernel had no usable ring once, it will not have one later either
+static bool unavailable;
+
+static void ring_unmap(void)
+{
+	if (ring.sqes)
+		munmap(ring.sqes, ring.sqes_size);
+	if (ring.cq_map && ring.cq_map != ring.sq_map)
+		munmap(ring.cq_map, ring.cq_map_size);
+	if (ring.sq_map)
+		munmap(ring.sq_map, ring.sq_map_size);
+	if (ring.fd != JUNK_VALUE)
+		close(ring.fd);
+
+	memset(&ring, 0, sizeof(ring));
+	ring.fd = JUNK_VALUE;
+}
+
+/**
+ * Check whether the ring can open files: IORING_OP_OPENAT came in 5.6, a
+ * ring of an older kernel fails it with -EINVAL. The probe came with it,
+ * a kernel that rejects the probe has no IORING_OP_OPENAT either.
+ */
+static bool ring_opens(void)
+{
+	size_t n = IORING_OP_OPENAT + 1;
+	struct io_uring_probe *probe = calloc(1, sizeof(*probe) + n * sizeof(probe->ops[0]));
+	bool opens;
+
+	DIE(probe == NULL, "Error allocating probe.");
+
+	opens = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, n) == SUCCESS
+		&& probe->last_op >= IORING_OP_OPENAT
+		&& (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+
+	return opens;
+}
+
+static bool ring_setup(void)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring.fd < 0) {
+		ring.fd = JUNK_VALUE;
+		unavailable = true;
+		return false;
+	}
+	ring.owner = getpid();
+
+	if (!ring_opens())
+		goto fail;
+
+	ring.sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring.cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	// since 5.4 both queues are in one mapping
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_map_size > ring.sq_map_size)
+			ring.sq_map_size = ring.cq_map_size;
+		ring.cq_map_size = ring.sq_map_size;
+	}
+
+	ring.sq_map = mmap(NULL, ring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					   ring.fd, IORING_OFF_SQ_RING);
+	if (ring.sq_map == MAP_FAILED) {
+		ring.sq_map = NULL;
+		goto fail;
+	}
+
+	ring.cq_map = ring.sq_map;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring.cq_map = mmap(NULL, ring.cq_map_size, PROT_READ | PROT_WRITE,
+						   MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+		if (ring.cq_map == MAP_FAILED) {
+			ring.cq_map = NULL;
+			goto fail;
+		}
+	}
+
+	ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					 ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED) {
+		ring.sqes = NULL;
+		goto fail;
+	}
+
+	sq = ring.sq_map;
+	ring.sq_head = (unsigned int *)(sq + p.sq_off.head);
+	ring.sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned int *)(sq + p.sq_off.array);
+
+	cq = ring.cq_map;
+	ring.cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ring.cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return true;
+
+fail:
+	ring_unmap();
+	unavailable = true;
+
+	return false;
+}
+
+/**
+ * Check whether batches go through the ring, setting it up if needed.
+ */
+static bool ring_ready(void)
+{
+	const char *value = vars_get(URING_VAR);
+
+	if (unavailable || (value && strcmp(value, "0") == 0))
+		return false;
+
+	// the mappings of the parent are shared with it, they must not be used
+	if (ring.fd != JUNK_VALUE && ring.owner != getpid())
+		ring_unmap();
+
+	return ring.fd != JUNK_VALUE || ring_setup();
+}
+
+static int ring_enter(unsigned int submit, unsigned int wait)
+{
+	int ret;
+
+	do
+		ret = syscall(__NR_io_uring_enter, ring.fd, submit, wait,
+					  wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/**
+ * Make n <= URING_ENTRIES opens as one chain of linked requests: the
+ * kernel runs them in order and cancels the rest after a failure.
+ */
+static void ring_open(struct uring_open *ops, unsigned int n)
+{
+	unsigned int tail = *ring.sq_tail, head, i, done;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+
+	for (i = 0; i < n; i++) {
+		sqe = &ring.sqes[tail & *ring.sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = ops[i].dirfd;
+		sqe->addr = (uintptr_t)ops[i].path;
+		sqe->len = ops[i].mode;
+		sqe->open_flags = ops[i].flags;
+		sqe->user_data = i;
+		if (i + 1 < n)
+			sqe->flags = IOSQE_IO_LINK;
+
+		ring.sq_array[tail & *ring.sq_mask] = tail & *ring.sq_mask;
+		tail++;
+	}
+	__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	// one system call submits the batch and waits for all of it
+	DIE(ring_enter(n, n) < 0, "io_uring_enter");
+
+	for (done = 0; done < n;) {
+		head = *ring.cq_head;
+		if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			DIE(ring_enter(tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE), 1) < 0,
+				"io_uring_enter");
+			continue;
+		}
+
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		ops[cqe->user_data].fd = cqe->res;
+		__atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+		done++;
+	}
+}
+
+void uring_open_all(struct uring_open *ops, size_t n)
+{
+	size_t i, chunk;
+
+	if (n >= URING_MIN_BATCH && ring_ready()) {
+		for (i = 0; i < n; i += chunk) {
+			chunk = n - i < URING_ENTRIES ? n - i : URING_ENTRIES;
+			ring_open(ops + i, chunk);
+
+			// a failure ends the chain, and the batch
+			if (ops[i + chunk - 1].fd < 0)
+				break;
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			ops[i].fd = openat(ops[i].dirfd, ops[i].path, ops[i].flags, ops[i].mode);
+			if (ops[i].fd < 0) {
+				ops[i].fd = -errno;
+				break;
+			}
+		}
+	}
+
+	// like the kernel does in a chain, nothing is opened after a failure
+	for (i = 0; i < n && ops[i].fd >= 0; i++)
+		;
+	for (i++; i < n; i++)
+		ops[i].fd = -ECANCELED;
+}
+
+void uring_free(void)
+{
+	ring_unmap();
+}
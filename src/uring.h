@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+
+// variable turning io_uring off when it is "0"
+#define URING_VAR "MINI_SHELL_URING"
+
+// submission queue entries of the ring, a longer batch goes in parts
+#define URING_ENTRIES 32
+
+// fewer operations than this are made with plain system calls
+#define URING_MIN_BATCH 2
+
+/*
+ * Batched system calls over io_uring
+
+ * Some of the I/O of the shell itself comes in bursts: a command with
+ * several redirections has all its files opened before it is forked. With
+ * io_uring, such a burst goes to the kernel as one submission, a single
+ * system call for the whole batch, instead of one call each.
+
+ * The ring is set up on first use with the raw system calls, there is no
+ * liburing; a child of the shell that uses it sets up its own, the rings
+ * are not shared across fork(). If the kernel has no io_uring (too old,
+ * turned off with kernel.io_uring_disabled, or hidden by a seccomp filter)
+ * or URING_VAR is "0", the same operations are made one by one, with the
+ * same results.
+ */
+
+/**
+ * One openat() of a batch; fd is its result: the descriptor, or -errno.
+ */
+struct uring_open {
+	int dirfd;
+	const char *path;
+	int flags;
+	mode_t mode;
+	int fd;
+};
+
+/**
+ * Open the files of a batch, in order. Like a sequence of openat(), the
+ * ones after a failure are not opened, their fd is -ECANCELED.
+ */
+void uring_open_all(struct uring_open *ops, size_t n);
+
+/**
+ * Tear down the ring of the shell.
+ */
+void uring_free(void);
+
+#endif /* _URING_H */
@@ -1,10 +1,35 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "brace.h"
+#include "expand.h"
 #include "utils.h"
+#include "vars.h"
+#include "wildcard.h"
+
+/**
+ * Arguments given by a word with braces or patterns, in word order.
+ */
+struct word_args {
+	char **args;
+	size_t count;
+	struct word_args *next;
+};
+
+/**
+ * Strings of a brace expansion being copied to the arena.
+ */
+struct brace_collect {
+	char **args;
+	size_t count;
+	struct arena *a;
+};
 
 /**
  * Counts the number of parts in a word
@@ -22,81 +47,430 @@ int word_count(word_t *s)
 	return num;
 }
 
+/**
+ * The string a part of a word stands for.
+ */
+static const char *part_value(word_t *s)
+{
+	const char *value;
+
+	// patterns and braces stand for themselves until get_argv() expands them
+	if (s->expand != true || s->kind == EXPAND_GLOB || s->kind == EXPAND_BRACE)
+		return s->string;
+
+	if (s->kind != EXPAND_VARIABLE)
+		return expand_part(s);
+
+	value = vars_get(s->string);
+
+	/* Prevents strlen from failing. */
+	return value ? value : "";
+}
+
+/**
+ * Length of the word once its parts are expanded and concatenated.
+ */
+size_t word_length(word_t *s)
+{
+	size_t length = 0;
+
+	for (; s != NULL; s = s->next_part)
+		length += strlen(part_value(s));
+
+	return length;
+}
+
+/**
+ * Expand and concatenate the parts of a word at dest, which must hold
+ * word_length() + 1 bytes. Returns the end of the written string.
+ */
+char *expand_word(word_t *s, char *dest)
+{
+	const char *substring;
+	size_t substring_length;
+
+	for (; s != NULL; s = s->next_part) {
+		substring = part_value(s);
+		substring_length = strlen(substring);
+
+		memcpy(dest, substring, substring_length);
+		dest += substring_length;
+	}
+	*dest = '\0';
+
+	return dest;
+}
+
 /**
  * Concatenate parts of the word to obtain the command.
  */
 char *get_word(word_t *s)
 {
-	char *string = NULL;
-	int string_length = 0;
+	char *string;
 
-	const char *substring = NULL;
-	int substring_length = 0;
+	if (s == NULL)
+		return NULL;
 
-	while (s != NULL) {
-		if (s->expand == true) {
-			substring = getenv(s->string);
+	// the length is known up front, every part is written once
+	string = malloc(word_length(s) + 1);
+	DIE(string == NULL, "Error allocating word string.");
 
-			/* Prevents strlen from failing. */
-			if (substring == NULL)
-				substring = "";
+	expand_word(s, string);
+
+	return string;
+}
+
+/**
+ * Check whether a word has a part of the given kind.
+ */
+static bool has_kind(word_t *s, expand_kind_t kind)
+{
+	for (; s != NULL; s = s->next_part)
+		if (s->expand == true && s->kind == kind)
+			return true;
+
+	return false;
+}
+
+/**
+ * Check whether a word has unquoted pattern characters.
+ */
+bool word_is_pattern(word_t *s)
+{
+	for (; s != NULL; s = s->next_part)
+		if (s->expand == true && (s->kind == EXPAND_GLOB
+			|| (s->kind == EXPAND_BRACE && strpbrk(s->string, "*?["))))
+			return true;
+
+	return false;
+}
+
+/**
+ * Copy value at p, with its pattern characters escaped. Returns the end of
+ * the written string.
+ */
+static char *escape_pattern(const char *value, char *p)
+{
+	for (; *value; value++) {
+		if (strchr("*?[]\\", *value))
+			*p++ = '\\';
+		*p++ = *value;
+	}
+	*p = '\0';
+
+	return p;
+}
+
+/**
+ * The word as a pattern: the characters of the quoted and expanded parts
+ * are escaped, so they only match themselves.
+ */
+static char *word_pattern(word_t *s, struct arena *a)
+{
+	size_t length = 0;
+	char *pattern, *p;
+	word_t *part;
+
+	for (part = s; part != NULL; part = part->next_part)
+		length += 2 * strlen(part_value(part));
+
+	pattern = p = arena_alloc(a, length + 1);
+	for (part = s; part != NULL; part = part->next_part) {
+		if (part->expand == true && part->kind == EXPAND_GLOB)
+			p = stpcpy(p, part->string);
+		else
+			p = escape_pattern(part_value(part), p);
+	}
+
+	return pattern;
+}
+
+/**
+ * Compile a word into a brace sequence; as a pattern, the text of the
+ * quoted and expanded parts is escaped.
+ */
+static void word_braces(word_t *s, bool pattern, struct brace_seq *seq, struct arena *a)
+{
+	const char *value;
+	char *escaped;
+
+	brace_init(seq);
+	for (; s != NULL; s = s->next_part) {
+		value = part_value(s);
+		if (s->expand == true && s->kind == EXPAND_BRACE) {
+			brace_add_braces(seq, value, a);
+		} else if (pattern && !(s->expand == true && s->kind == EXPAND_GLOB)) {
+			escaped = arena_alloc(a, 2 * strlen(value) + 1);
+			brace_add_text(seq, escaped, escape_pattern(value, escaped) - escaped, a);
 		} else {
-			substring = s->string;
+			brace_add_text(seq, value, strlen(value), a);
 		}
+	}
+}
 
-		substring_length = strlen(substring);
+static bool collect_string(const char *str, size_t len, void *data)
+{
+	struct brace_collect *c = data;
+	char *copy;
 
-		string = realloc(string, string_length + substring_length + 1);
-		DIE(string == NULL, "Error allocating word string.");
+	// like an unquoted empty word, an empty string is no argument
+	if (!len)
+		return true;
 
-		string[string_length] = '\0';
-		strcat(string, substring);
+	copy = arena_alloc(c->a, len + 1);
+	memcpy(copy, str, len + 1);
+	c->args[c->count++] = copy;
 
-		string_length += substring_length;
+	return true;
+}
 
-		s = s->next_part;
+/**
+ * Remove the backslashes of a pattern that matched nothing, in place.
+ */
+static char *unescape_pattern(char *pattern)
+{
+	char *src, *dest;
+
+	for (src = dest = pattern; *src; src++) {
+		if (*src == '\\' && src[1])
+			src++;
+		*dest++ = *src;
 	}
+	*dest = '\0';
 
-	return string;
+	return pattern;
+}
+
+/**
+ * Expand the braces of a word, straight into the arena, then match the
+ * strings that are patterns. Returns the number of arguments; *args is
+ * left alone if the word is too big and is kept as it is.
+ */
+static size_t brace_args(word_t *s, char ***args, struct arena *a)
+{
+	bool pattern = word_is_pattern(s);
+	struct brace_collect c;
+	struct brace_seq seq;
+	char ***paths;
+	size_t *npaths, total, i, j;
+
+	word_braces(s, pattern, &seq, a);
+	if (seq.count > BRACE_MAX_WORDS) {
+		fprintf(stderr, "Brace expansion too large\n");
+		return 0;
+	}
+
+	c.args = arena_alloc(a, seq.count * sizeof(*c.args));
+	c.count = 0;
+	c.a = a;
+	brace_each(&seq, collect_string, &c, a);
+
+	if (!pattern) {
+		*args = c.args;
+		return c.count;
+	}
+
+	paths = arena_alloc(a, c.count * sizeof(*paths));
+	npaths = arena_alloc(a, c.count * sizeof(*npaths));
+	for (i = 0, total = 0; i < c.count; i++) {
+		npaths[i] = wildcard_expand(c.args[i], &paths[i], a);
+		total += npaths[i] ? npaths[i] : 1;
+	}
+
+	*args = arena_alloc(a, total * sizeof(**args));
+	for (i = 0, total = 0; i < c.count; i++) {
+		if (!npaths[i])
+			(*args)[total++] = unescape_pattern(c.args[i]);
+		for (j = 0; j < npaths[i]; j++)
+			(*args)[total++] = paths[i][j];
+	}
+
+	return total;
+}
+
+/**
+ * Count the arguments a word gives and the room their strings need; the
+ * arguments of words with braces or patterns are built in the arena and
+ * queued for put_word().
+ */
+static void measure_word(word_t *s, int *argc, size_t *length,
+			 struct word_args ***tail, struct arena *a)
+{
+	struct word_args *w;
+
+	if (has_kind(s, EXPAND_BRACE) || word_is_pattern(s)) {
+		w = arena_alloc(a, sizeof(*w));
+		w->args = NULL;
+		if (has_kind(s, EXPAND_BRACE))
+			w->count = brace_args(s, &w->args, a);
+		else
+			w->count = wildcard_expand(word_pattern(s, a), &w->args, a);
+		w->next = NULL;
+		**tail = w;
+		*tail = &w->next;
+
+		if (w->args) {
+			*argc += w->count;
+			return;
+		}
+	}
+
+	// no match keeps the pattern as it is
+	*argc += 1;
+	*length += word_length(s) + 1;
+}
+
+/**
+ * Add the arguments of a word to argv, writing its string at strings.
+ * Returns where the next string goes.
+ */
+static char *put_word(word_t *s, char **argv, int *argc, char *strings,
+		      struct word_args **queue)
+{
+	struct word_args *w;
+	size_t i;
+
+	if (has_kind(s, EXPAND_BRACE) || word_is_pattern(s)) {
+		w = *queue;
+		*queue = w->next;
+
+		if (w->args) {
+			for (i = 0; i < w->count; i++)
+				argv[(*argc)++] = w->args[i];
+			return strings;
+		}
+	}
+
+	argv[(*argc)++] = strings;
+
+	return expand_word(s, strings) + 1;
 }
 
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
  * them directly to execv.
  */
-char **get_argv(simple_command_t *command, int *size)
+char **get_argv(simple_command_t *command, int *size, struct arena *a)
 {
+	struct word_args *queue = NULL, **tail = &queue;
 	char **argv;
+	char *strings;
 	int argc;
+	size_t length;
 
 	word_t *param;
 
-	argc = 1;
+	/* Get parameters number and the room their strings need. */
+	argc = 0;
+	length = 0;
+	measure_word(command->verb, &argc, &length, &tail, a);
+	for (param = command->params; param != NULL; param = param->next_word)
+		measure_word(param, &argc, &length, &tail, a);
+
+	// the pointer array and the strings come from a single allocation,
+	// expanded braces and matched paths are already in the arena
+	argv = arena_alloc(a, (argc + 1) * sizeof(char *) + length);
+	strings = (char *)(argv + argc + 1);
+
+	argc = 0;
+	strings = put_word(command->verb, argv, &argc, strings, &queue);
+	for (param = command->params; param != NULL; param = param->next_word)
+		strings = put_word(param, argv, &argc, strings, &queue);
+	argv[argc] = NULL;
+
+	*size = argc;
 
-	/* Get parameters number. */
-	param = command->params;
-	while (param != NULL) {
-		param = param->next_word;
-		argc++;
+	return argv;
+}
+
+size_t count_args(word_t *words, struct arena *a)
+{
+	struct brace_seq seq;
+	size_t count = 0;
+
+	for (; words != NULL; words = words->next_word) {
+		word_braces(words, false, &seq, a);
+		count = count > SIZE_MAX - seq.count ? SIZE_MAX : count + seq.count;
 	}
 
-	argv = calloc(argc + 1, sizeof(char *));
-	DIE(argv == NULL, "Error allocating argv.");
+	return count;
+}
 
-	argv[0] = get_word(command->verb);
-	DIE(argv[0] == NULL, "Error retrieving word.");
+bool each_arg(word_t *words, brace_emit_t emit, void *data, struct arena *a)
+{
+	struct brace_seq seq;
 
-	param = command->params;
-	argc = 1;
-	while (param != NULL) {
-		argv[argc] = get_word(param);
-		DIE(argv[argc] == NULL, "Error retrieving word.");
+	for (; words != NULL; words = words->next_word) {
+		word_braces(words, false, &seq, a);
+		if (!brace_each(&seq, emit, data, a))
+			return false;
+	}
 
-		param = param->next_word;
-		argc++;
+	return true;
+}
+
+/**
+ * Write a whole buffer, across partial writes and signals.
+ */
+bool write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		buf += n;
+		len -= n;
 	}
 
-	*size = argc;
+	return true;
+}
 
-	return argv;
+/**
+ * Readline from mini-shell.
+ */
+char *read_line(FILE *stream)
+{
+	char *line = NULL;
+	size_t line_length = 0;
+	size_t line_size = 0;
+
+	char chunk[CHUNK_SIZE];
+	size_t chunk_length;
+
+	char *rc;
+
+	int endline = 0;
+
+	while (!endline) {
+		rc = fgets(chunk, CHUNK_SIZE, stream);
+		if (rc == NULL)
+			break;
+
+		chunk_length = strlen(chunk);
+		if (chunk[chunk_length - 1] == '\n') {
+			if (chunk_length > 1 && chunk[chunk_length - 2] == '\r')
+				/* Windows */
+				chunk_length -= 2;
+			else
+				chunk_length -= 1;
+			chunk[chunk_length] = 0;
+			endline = 1;
+		}
+
+		// the buffer doubles and chunks are appended at the known end, long lines stay linear
+		if (line_length + chunk_length + 1 > line_size) {
+			line_size = line_size ? 2 * line_size : CHUNK_SIZE;
+			line = realloc(line, line_size);
+			DIE(line == NULL, "Error allocating command line");
+		}
+
+		memcpy(line + line_length, chunk, chunk_length + 1);
+		line_length += chunk_length;
+	}
+
+	return line;
 }
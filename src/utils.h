@@ -7,9 +7,17 @@
 #include <stdlib.h>
 
 #include "../util/parser/parser.h"
+#include "arena.h"
+#include "brace.h"
 
 #define EXIT_FAILURE 1
 
+// read_line() reads its input in chunks of this size
+#define CHUNK_SIZE 1024
+
+// room for the decimal form of a 64-bit integer, sign and '\0' included
+#define NUMBER_SIZE 21
+
 /* Useful macro for handling error codes. */
 #define DIE(assertion, call_description)			\
 	do {							\
@@ -26,6 +34,17 @@
 */
 int word_count(word_t *s);
 
+/**
+ * Length of the word once its parts are expanded and concatenated.
+ */
+size_t word_length(word_t *s);
+
+/**
+ * Expand and concatenate the parts of a word at dest, which must hold
+ * word_length() + 1 bytes. Returns the end of the written string.
+ */
+char *expand_word(word_t *s, char *dest);
+
 /**
  * Concatenate parts of the word to obtain the command.
  */
@@ -33,8 +52,40 @@ char *get_word(word_t *s);
 
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
- * them directly to execv.
+ * them directly to execv. A word with braces gives every string they stand
+ * for; a word with unquoted pattern characters gives the paths it matches,
+ * or itself if there are none. The list and its strings are allocated from
+ * the arena.
+ */
+char **get_argv(simple_command_t *command, int *size, struct arena *a);
+
+/**
+ * Check whether a word has unquoted pattern characters.
+ */
+bool word_is_pattern(word_t *s);
+
+/**
+ * Number of arguments a word list gives once its braces are expanded, a
+ * pattern counting as one. SIZE_MAX if it does not fit.
+ */
+size_t count_args(word_t *words, struct arena *a);
+
+/**
+ * Call emit for every argument of a word list, its braces expanded but its
+ * patterns not matched, without building the list. Returns false if emit
+ * stopped.
+ */
+bool each_arg(word_t *words, brace_emit_t emit, void *data, struct arena *a);
+
+/**
+ * Write a whole buffer to fd, across partial writes. Returns false on error.
+ */
+bool write_all(int fd, const char *buf, size_t len);
+
+/**
+ * Readline from mini-shell: read a whole line from stream, without the
+ * line terminator. Returns NULL at the end of the input.
  */
-char **get_argv(simple_command_t *command, int *size);
+char *read_line(FILE *stream);
 
 #endif /* _UTILS_H */
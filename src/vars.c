@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "vars.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static struct var **buckets;
+static size_t nbuckets;
+static size_t nvars;
+
+// bumped whenever an exported variable changes
+static unsigned long generation = 1;
+
+static char **envp;
+static size_t envp_size;
+static size_t envp_count;
+static unsigned long envp_generation;
+
+static unsigned int hash_name(const char *name, size_t len)
+{
+	unsigned int hash = FNV_OFFSET;
+
+	while (len--) {
+		hash ^= (unsigned char)*name++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static struct var *lookup(const char *name, size_t len, unsigned int hash)
+{
+	struct var *v;
+
+	if (!buckets)
+		return NULL;
+
+	for (v = buckets[hash & (nbuckets - 1)]; v; v = v->next)
+		if (v->hash == hash && strncmp(v->name, name, len) == 0 && v->name[len] == '\0')
+			return v;
+
+	return NULL;
+}
+
+static void grow(void)
+{
+	struct var **old = buckets, *v, *next;
+	size_t old_size = nbuckets, i;
+
+	nbuckets = nbuckets ? 2 * nbuckets : VARS_BUCKETS;
+	buckets = calloc(nbuckets, sizeof(*buckets));
+	DIE(buckets == NULL, "Error allocating variables.");
+
+	for (i = 0; i < old_size; i++)
+		for (v = old[i]; v; v = next) {
+			next = v->next;
+			v->next = buckets[v->hash & (nbuckets - 1)];
+			buckets[v->hash & (nbuckets - 1)] = v;
+		}
+
+	free(old);
+}
+
+static struct var *create(const char *name, size_t len, unsigned int hash)
+{
+	struct var *v;
+
+	if (nvars >= nbuckets)
+		grow();
+
+	v = calloc(1, sizeof(*v));
+	DIE(v == NULL, "Error allocating variable.");
+
+	v->name = strndup(name, len);
+	DIE(v->name == NULL, "Error allocating variable.");
+	v->hash = hash;
+	v->next = buckets[hash & (nbuckets - 1)];
+	buckets[hash & (nbuckets - 1)] = v;
+	nvars++;
+
+	return v;
+}
+
+/**
+ * Store a new value; entry points into the "name=value" string.
+ */
+static void assign(struct var *v, const char *value)
+{
+	size_t name_len = strlen(v->name), value_len = strlen(value);
+	char *entry;
+
+	// value may point into the old entry, it is released last
+	entry = malloc(name_len + value_len + 2);
+	DIE(entry == NULL, "Error allocating variable.");
+
+	memcpy(entry, v->name, name_len);
+	entry[name_len] = '=';
+	memcpy(entry + name_len + 1, value, value_len + 1);
+
+	free(v->entry);
+	v->entry = entry;
+	v->value = entry + name_len + 1;
+
+	if (v->exported)
+		generation++;
+}
+
+void vars_init(char **env)
+{
+	const char *eq;
+	struct var *v;
+	unsigned int hash;
+
+	for (; env && *env; env++) {
+		eq = strchr(*env, '=');
+		if (!eq)
+			continue;
+
+		hash = hash_name(*env, eq - *env);
+		v = lookup(*env, eq - *env, hash);
+		if (!v)
+			v = create(*env, eq - *env, hash);
+		v->exported = true;
+		assign(v, eq + 1);
+	}
+}
+
+const char *vars_get(const char *name)
+{
+	size_t len = strlen(name);
+	struct var *v = lookup(name, len, hash_name(name, len));
+
+	return v ? v->value : NULL;
+}
+
+void vars_set(const char *name, const char *value)
+{
+	size_t len = strlen(name);
+	unsigned int hash = hash_name(name, len);
+	struct var *v = lookup(name, len, hash);
+
+	if (!v)
+		v = create(name, len, hash);
+
+	// assigning the value a variable already has is a frequent no-op
+	if (v->value && strcmp(v->value, value) == 0)
+		return;
+
+	assign(v, value);
+}
+
+void vars_export(const char *name)
+{
+	size_t len = strlen(name);
+	unsigned int hash = hash_name(name, len);
+	struct var *v = lookup(name, len, hash);
+
+	if (!v)
+		v = create(name, len, hash);
+
+	if (v->exported)
+		return;
+
+	v->exported = true;
+	if (v->value)
+		generation++;
+}
+
+char **vars_envp(void)
+{
+	struct var *v;
+	size_t i, n = 0;
+
+	if (envp && envp_generation == generation)
+		return envp;
+
+	if (envp_size < nvars + 1) {
+		envp_size = nvars + 1;
+		free(envp);
+		envp = malloc(envp_size * sizeof(*envp));
+		DIE(envp == NULL, "Error allocating environment.");
+	}
+
+	for (i = 0; i < nbuckets; i++)
+		for (v = buckets[i]; v; v = v->next)
+			if (v->exported && v->value) {
+				v->envp_index = n;
+				envp[n++] = v->entry;
+			}
+	envp[n] = NULL;
+	envp_count = n;
+
+	envp_generation = generation;
+
+	return envp;
+}
+
+char **vars_envp_overlay(char **entries, size_t n)
+{
+	char **env = vars_envp();
+	size_t i, j, len, count = envp_count;
+	struct var *v;
+
+	// room for the appended entries, the slots of envp are only pointers
+	if (envp_size < envp_count + n + 1) {
+		envp_size = envp_count + n + 1;
+		env = realloc(envp, envp_size * sizeof(*envp));
+		DIE(env == NULL, "Error allocating environment.");
+		envp = env;
+	}
+
+	for (i = 0; i < n; i++) {
+		len = strchr(entries[i], '=') - entries[i];
+		v = lookup(entries[i], len, hash_name(entries[i], len));
+
+		if (v && v->exported && v->value) {
+			env[v->envp_index] = entries[i];
+			continue;
+		}
+
+		// a later entry for the same name wins, like in bash
+		for (j = envp_count; j < count; j++)
+			if (strncmp(env[j], entries[i], len + 1) == 0)
+				break;
+		if (j == count)
+			count++;
+		env[j] = entries[i];
+	}
+	env[count] = NULL;
+
+	// the patched array no longer matches the store
+	envp_generation = 0;
+
+	return env;
+}
+
+void vars_free(void)
+{
+	struct var *v, *next;
+	size_t i;
+
+	for (i = 0; i < nbuckets; i++)
+		for (v = buckets[i]; v; v = next) {
+			next = v->next;
+			free(v->name);
+			free(v->entry);
+			free(v);
+		}
+
+	free(buckets);
+	free(envp);
+	buckets = NULL;
+	envp = NULL;
+	nbuckets = nvars = envp_size = 0;
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _VARS_H
+#define _VARS_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+extern char **environ;
+
+// initial number of hash buckets of the variable store, doubled as it fills
+#define VARS_BUCKETS 256
+
+/*
+ * Shell variable store
+
+ * Variables live in a hash table, so expanding or assigning one is O(1)
+ * instead of a scan of environ. Variables inherited from the environment
+ * and the ones given to export are exported; plain assignments create
+ * shell-only variables, like in bash.
+
+ * The envp array handed to exec is rebuilt only when an exported variable
+ * changed since the last build (tracked by a generation counter).
+ */
+
+struct var {
+	char *name;
+
+	// NULL for a variable exported before being assigned
+	char *value;
+
+	// "name=value", the string placed in envp
+	char *entry;
+
+	bool exported;
+	unsigned int hash;
+
+	// position of entry in the last built envp, if it is exported and set
+	size_t envp_index;
+	struct var *next;
+};
+
+/**
+ * Import the variables of the environment, all of them exported.
+ */
+void vars_init(char **env);
+
+/**
+ * Value of a variable, NULL if it is not set.
+ */
+const char *vars_get(const char *name);
+
+/**
+ * Set a variable; it stays exported if it already was.
+ */
+void vars_set(const char *name, const char *value);
+
+/**
+ * Mark a variable as exported (an unset one is exported once assigned).
+ */
+void vars_export(const char *name);
+
+/**
+ * NULL terminated "name=value" array of the exported variables, rebuilt
+ * only if one of them changed since the previous call.
+ */
+char **vars_envp(void);
+
+/**
+ * Patch the envp of this process with n "name=value" entries, without
+ * copying it: an exported variable has its slot replaced, any other one is
+ * appended. Meant for a child about to exec a command with prefix
+ * assignments (NAME=value cmd); the entries are not copied.
+ */
+char **vars_envp_overlay(char **entries, size_t n);
+
+/**
+ * Release the variable store.
+ */
+void vars_free(void);
+
+#endif /* _VARS_H */
@@ -0,0 +1,570 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "wildcard.h"
+
+#define NONE SIZE_MAX
+
+// set of bytes matched by a bracket expression
+#define SET_BYTES (256 / 8)
+#define SET_ADD(set, c) ((set)[(unsigned char)(c) / 8] |= 1 << ((unsigned char)(c) % 8))
+#define SET_HAS(set, c) ((set)[(unsigned char)(c) / 8] & 1 << ((unsigned char)(c) % 8))
+
+enum token_type {
+	TOKEN_LITERAL,
+	TOKEN_ONE,
+	TOKEN_STAR,
+	TOKEN_SET
+};
+
+struct token {
+	enum token_type type;
+	size_t len;
+	const char *text;
+	const unsigned char *set;
+};
+
+/**
+ * A compiled path component, or string pattern.
+ */
+struct wildcard_matcher {
+	struct token *tokens;
+	size_t ntokens;
+
+	// a literal text every match ends with, checked before anything else
+	const char *suffix;
+	size_t suffix_len;
+
+	// a leading '.' has to be matched explicitly
+	bool dot;
+};
+
+struct dir_entry {
+	const char *name;
+	size_t len;
+	unsigned char type;
+};
+
+/**
+ * Listing of a directory, kept for the command line.
+ */
+struct dir_listing {
+	const char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+
+	struct dir_entry *entries;
+	size_t count;
+
+	struct dir_listing *next;
+};
+
+static const struct {
+	const char *name;
+	int (*is)(int c);
+} classes[] = {
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+	{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+	{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+	{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+// listings of the current command line
+static struct arena listing_arena;
+static struct dir_listing *listings;
+
+// getdents64() buffer, and the entries of the directory being read
+static char *dents;
+static struct dir_entry *scratch;
+static size_t scratch_size;
+
+// paths matched by the current pattern
+static char **found;
+static size_t nfound, found_size;
+
+bool wildcard_has_magic(const char *pattern)
+{
+	for (; *pattern; pattern++) {
+		if (*pattern == '\\' && pattern[1])
+			pattern++;
+		else if (*pattern == '*' || *pattern == '?' || *pattern == '[')
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Parse the bracket expression at p (just after '['). Returns the end of
+ * the expression, or NULL if it is not closed and '[' is a literal.
+ */
+static const char *parse_set(const char *p, const char *end, unsigned char *set)
+{
+	unsigned char first, last;
+	bool negate = false;
+	size_t i, c, len;
+
+	memset(set, 0, SET_BYTES);
+
+	if (p < end && (*p == '!' || *p == '^')) {
+		negate = true;
+		p++;
+	}
+
+	// a ']' right at the start is a member
+	for (i = 0; p < end && (*p != ']' || i == 0); i++) {
+		if (p[0] == '[' && p + 1 < end && p[1] == ':') {
+			for (c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+				len = strlen(classes[c].name);
+				if (p + 2 + len + 1 < end && strncmp(p + 2, classes[c].name, len) == 0
+					&& p[2 + len] == ':' && p[3 + len] == ']')
+					break;
+			}
+			if (c < sizeof(classes) / sizeof(classes[0])) {
+				for (first = 1; first; first++)
+					if (classes[c].is(first))
+						SET_ADD(set, first);
+				p += 4 + strlen(classes[c].name);
+				continue;
+			}
+		}
+
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		first = last = *p++;
+
+		if (p + 1 < end && *p == '-' && p[1] != ']') {
+			p++;
+			if (*p == '\\' && p + 1 < end)
+				p++;
+			last = *p++;
+		}
+
+		for (c = first; c <= last; c++)
+			SET_ADD(set, c);
+	}
+
+	if (p >= end)
+		return NULL;
+
+	if (negate)
+		for (i = 0; i < SET_BYTES; i++)
+			set[i] = ~set[i];
+
+	return p + 1;
+}
+
+/**
+ * Compile the component [p, end) of a pattern.
+ */
+static void compile(struct wildcard_matcher *m, const char *p, const char *end,
+		    struct arena *a)
+{
+	struct token *t;
+	unsigned char *set;
+	const char *next;
+	char *text;
+
+	// at most one token per pattern character
+	m->tokens = arena_alloc(a, (end - p + 1) * sizeof(*m->tokens));
+	m->ntokens = 0;
+	m->dot = *p == '.';
+
+	text = arena_alloc(a, end - p + 1);
+
+	while (p < end) {
+		t = &m->tokens[m->ntokens];
+
+		if (*p == '*') {
+			// consecutive stars are one
+			if (!m->ntokens || t[-1].type != TOKEN_STAR) {
+				t->type = TOKEN_STAR;
+				m->ntokens++;
+			}
+			p++;
+			continue;
+		}
+
+		if (*p == '?') {
+			t->type = TOKEN_ONE;
+			m->ntokens++;
+			p++;
+			continue;
+		}
+
+		if (*p == '[') {
+			set = arena_alloc(a, SET_BYTES);
+			next = parse_set(p + 1, end, set);
+			if (next) {
+				t->type = TOKEN_SET;
+				t->set = set;
+				m->ntokens++;
+				p = next;
+				continue;
+			}
+		}
+
+		// literal run, merged with the previous one
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		if (!m->ntokens || t[-1].type != TOKEN_LITERAL) {
+			t->type = TOKEN_LITERAL;
+			t->text = text;
+			t->len = 0;
+			m->ntokens++;
+		} else {
+			t--;
+		}
+		*text++ = *p++;
+		t->len++;
+	}
+
+	m->suffix = NULL;
+	m->suffix_len = 0;
+	if (m->ntokens && m->tokens[m->ntokens - 1].type == TOKEN_LITERAL) {
+		m->suffix = m->tokens[m->ntokens - 1].text;
+		m->suffix_len = m->tokens[m->ntokens - 1].len;
+	}
+}
+
+/**
+ * Match a name against a compiled component. Stars backtrack to the last
+ * one only, so a match is linear in practice.
+ */
+static bool match(const struct wildcard_matcher *m, const char *s, size_t n)
+{
+	size_t ti = 0, si = 0, star = NONE, star_si = 0;
+	const struct token *t;
+
+	if (n && *s == '.' && !m->dot)
+		return false;
+
+	if (m->suffix_len && (m->suffix_len > n
+		|| memcmp(s + n - m->suffix_len, m->suffix, m->suffix_len) != 0))
+		return false;
+
+	while (si < n || ti < m->ntokens) {
+		if (ti < m->ntokens) {
+			t = &m->tokens[ti];
+			switch (t->type) {
+			case TOKEN_STAR:
+				star = ti++;
+				star_si = si;
+				continue;
+			case TOKEN_ONE:
+				if (si < n) {
+					ti++;
+					si++;
+					continue;
+				}
+				break;
+			case TOKEN_SET:
+				if (si < n && SET_HAS(t->set, s[si])) {
+					ti++;
+					si++;
+					continue;
+				}
+				break;
+			case TOKEN_LITERAL:
+				if (n - si >= t->len && memcmp(s + si, t->text, t->len) == 0) {
+					ti++;
+					si += t->len;
+					continue;
+				}
+				break;
+			}
+		}
+
+		// let the last star eat one more character
+		if (star == NONE || star_si >= n)
+			return false;
+		ti = star + 1;
+		si = ++star_si;
+	}
+
+	return true;
+}
+
+struct wildcard_matcher *wildcard_compile(const char *pattern, struct arena *a)
+{
+	struct wildcard_matcher *m = arena_alloc(a, sizeof(*m));
+
+	compile(m, pattern, pattern + strlen(pattern), a);
+	m->dot = true;
+
+	return m;
+}
+
+bool wildcard_match(const struct wildcard_matcher *m, const char *s, size_t n)
+{
+	return match(m, s, n);
+}
+
+static void add_entry(const char *name, unsigned char type, size_t *count)
+{
+	size_t len = strlen(name);
+	char *copy;
+
+	if (*count == scratch_size) {
+		scratch_size = scratch_size ? 2 * scratch_size : CHUNK_SIZE;
+		scratch = realloc(scratch, scratch_size * sizeof(*scratch));
+		DIE(scratch == NULL, "Error allocating directory listing.");
+	}
+
+	copy = arena_alloc(&listing_arena, len + 1);
+	memcpy(copy, name, len + 1);
+
+	scratch[*count].name = copy;
+	scratch[*count].len = len;
+	scratch[*count].type = type;
+	(*count)++;
+}
+
+/**
+ * Read a whole directory with getdents64(), into a listing.
+ */
+static bool read_listing(struct dir_listing *l, int fd)
+{
+	struct dirent64 *d;
+	size_t count = 0;
+	ssize_t n, off;
+
+	if (!dents) {
+		dents = malloc(WILDCARD_DENTS_SIZE);
+		DIE(dents == NULL, "Error allocating directory buffer.");
+	}
+
+	while ((n = getdents64(fd, dents, WILDCARD_DENTS_SIZE)) > 0) {
+		for (off = 0; off < n; off += d->d_reclen) {
+			d = (struct dirent64 *)(dents + off);
+			if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+				continue;
+			add_entry(d->d_name, d->d_type, &count);
+		}
+	}
+	if (n < 0)
+		return false;
+
+	l->entries = arena_alloc(&listing_arena, count * sizeof(*l->entries));
+	if (count)
+		memcpy(l->entries, scratch, count * sizeof(*l->entries));
+	l->count = count;
+
+	return true;
+}
+
+/**
+ * Listing of a directory, read once per command line unless it changed.
+ */
+static struct dir_listing *get_listing(const char *path)
+{
+	struct dir_listing *l;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	for (l = listings; l; l = l->next)
+		if (strcmp(l->path, path) == 0)
+			break;
+
+	if (l && l->dev == st.st_dev && l->ino == st.st_ino
+		&& l->mtime.tv_sec == st.st_mtim.tv_sec && l->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+		close(fd);
+		return l;
+	}
+
+	if (!l) {
+		l = arena_alloc(&listing_arena, sizeof(*l));
+		l->path = arena_strdup(&listing_arena, path);
+		l->next = listings;
+		listings = l;
+	}
+
+	l->dev = st.st_dev;
+	l->ino = st.st_ino;
+	l->mtime = st.st_mtim;
+	if (!read_listing(l, fd))
+		l->count = 0;
+
+	close(fd);
+
+	return l;
+}
+
+static void add_found(char *path)
+{
+	if (nfound == found_size) {
+		found_size = found_size ? 2 * found_size : CHUNK_SIZE;
+		found = realloc(found, found_size * sizeof(*found));
+		DIE(found == NULL, "Error allocating matched paths.");
+	}
+
+	found[nfound++] = path;
+}
+
+/**
+ * Append a name to a directory path, in the arena.
+ */
+static char *join(const char *dir, const char *name, size_t len, struct arena *a)
+{
+	size_t dir_len = strlen(dir);
+	bool slash = dir_len && dir[dir_len - 1] != '/';
+	char *path = arena_alloc(a, dir_len + slash + len + 1);
+
+	memcpy(path, dir, dir_len);
+	if (slash)
+		path[dir_len] = '/';
+	memcpy(path + dir_len + slash, name, len);
+	path[dir_len + slash + len] = '\0';
+
+	return path;
+}
+
+static bool is_dir(const char *path, unsigned char type)
+{
+	struct stat st;
+
+	if (type == DT_DIR)
+		return true;
+	if (type != DT_UNKNOWN && type != DT_LNK)
+		return false;
+
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * Expand the components of rest below the directory dir ("" for the
+ * current one), adding the paths found.
+ */
+static void walk(const char *dir, const char *rest, struct arena *a)
+{
+	const char *end, *next, *p;
+	struct dir_listing *l;
+	struct wildcard_matcher m;
+	struct stat st;
+	char *path, *name;
+	size_t i, len;
+	bool last;
+
+	// a pattern ending with '/' only matches directories, and keeps the '/'
+	if (!*rest) {
+		add_found(join(dir, "", 0, a));
+		return;
+	}
+
+	for (end = rest; *end && *end != '/'; end++)
+		if (*end == '\\' && end[1])
+			end++;
+	for (next = end; *next == '/'; next++)
+		;
+	last = *end == '\0';
+
+	for (p = rest; p < end; p++) {
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		else if (*p == '*' || *p == '?' || *p == '[')
+			break;
+	}
+
+	// a component without pattern characters is not looked up in a listing
+	if (p == end) {
+		name = arena_alloc(a, end - rest + 1);
+		for (len = 0, p = rest; p < end; p++) {
+			if (*p == '\\' && p + 1 < end)
+				p++;
+			name[len++] = *p;
+		}
+		path = join(dir, name, len, a);
+
+		if (last) {
+			if (lstat(path, &st) == 0)
+				add_found(path);
+		} else {
+			walk(path, next, a);
+		}
+		return;
+	}
+
+	l = get_listing(*dir ? dir : ".");
+	if (!l)
+		return;
+
+	compile(&m, rest, end, a);
+	for (i = 0; i < l->count; i++) {
+		if (!match(&m, l->entries[i].name, l->entries[i].len))
+			continue;
+
+		path = join(dir, l->entries[i].name, l->entries[i].len, a);
+		if (last)
+			add_found(path);
+		else if (is_dir(path, l->entries[i].type))
+			walk(path, next, a);
+	}
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+size_t wildcard_expand(const char *pattern, char ***paths, struct arena *a)
+{
+	nfound = 0;
+
+	if (*pattern == '/') {
+		while (pattern[1] == '/')
+			pattern++;
+		walk("/", pattern + 1, a);
+	} else {
+		walk("", pattern, a);
+	}
+
+	if (!nfound)
+		return 0;
+
+	qsort(found, nfound, sizeof(*found), compare_paths);
+
+	*paths = arena_alloc(a, nfound * sizeof(**paths));
+	memcpy(*paths, found, nfound * sizeof(**paths));
+
+	return nfound;
+}
+
+void wildcard_release(void)
+{
+	arena_reset(&listing_arena);
+	listings = NULL;
+}
+
+void wildcard_free(void)
+{
+	wildcard_release();
+	arena_free(&listing_arena);
+
+	free(dents);
+	free(scratch);
+	free(found);
+	dents = NULL;
+	scratch = NULL;
+	found = NULL;
+	scratch_size = found_size = nfound = 0;
+}
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _WILDCARD_H
+#define _WILDCARD_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+#include "arena.h"
+
+// bytes asked from getdents64() at a time, few calls even for huge directories
+#define WILDCARD_DENTS_SIZE (256 * 1024)
+
+/*
+ * Pathname expansion (globbing)
+
+ * A pattern is split on '/' and every component with *, ? or [...] is
+ * matched against the entries of the directories reached so far; the other
+ * components are used as they are. A backslash makes the next character
+ * literal. Names starting with '.' are only matched by a component that
+ * starts with '.', and "." and ".." never are. Matching works on bytes.
+
+ * Directories are read with getdents64() in big chunks and their listings
+ * are kept until wildcard_release(), at the end of the command line, so
+ * several patterns over one directory read it once. A listing is read
+ * again if the modification time of the directory changed meanwhile.
+
+ * Each component is compiled once into a list of tokens (literal runs, ?,
+ * *, bracket expressions as 256-bit sets) before it is matched against a
+ * directory.
+ */
+
+/**
+ * Check whether a pattern has unescaped pattern characters.
+ */
+bool wildcard_has_magic(const char *pattern);
+
+struct wildcard_matcher;
+
+/**
+ * Compile a pattern to match strings rather than path names: '/' and a
+ * leading '.' are ordinary characters for it.
+ */
+struct wildcard_matcher *wildcard_compile(const char *pattern, struct arena *a);
+
+/**
+ * Check whether the n bytes at s match a compiled pattern as a whole.
+ */
+bool wildcard_match(const struct wildcard_matcher *m, const char *s, size_t n);
+
+/**
+ * Expand a pattern into the paths it matches, sorted. The array and the
+ * paths are allocated from the arena. Returns the number of paths, 0 if
+ * nothing matches.
+ */
+size_t wildcard_expand(const char *pattern, char ***paths, struct arena *a);
+
+/**
+ * Forget the directory listings, at the end of a command line.
+ */
+void wildcard_release(void);
+
+/**
+ * Release all the memory kept by the pathname expansion.
+ */
+void wildcard_free(void);
+
+#endif /* _WILDCARD_H */
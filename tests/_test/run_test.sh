@@ -13,7 +13,8 @@ MAIN_TEST_DIR="_test/outputs"
 INPUT_DIR="_test/inputs"
 REFS_DIR="_test/refs"
 LOG_FILE="/dev/null"
-export max_points=100
+# the tests below, and 10 for the source check
+export max_points=120
 TEST_TIMEOUT=30
 
 TEST_LIB=_test/test_lib.sh
@@ -203,6 +204,46 @@ test_exec_failed() {
 	cleanup_test
 }
 
+# Test 19.
+test_compiled() {
+	init_test
+
+	# Commands to execute the test.
+	execute_cmd "$ref_name" "../${IN_FILE}"
+	# Move OUT_DIR in order to preserve the pwd output.
+	mv "${OUT_DIR}" "${REF_DIR}"
+	$exec_name --compile "${IN_FILE}" -o "${TEST_NAME}.msc" &>"$LOG_FILE"
+	execute_cmd "$exec_name ../${TEST_NAME}.msc" /dev/null
+
+	# Test output.
+	basic_test diff -r -ui -x "$VALGRIND_LOG" "${REF_DIR}" "${OUT_DIR}"
+
+	cleanup_test
+}
+
+# Test 20.
+test_deep_tree() {
+	init_test
+
+	# A single line of 10^6 commands: the grammar is left-recursive, so the
+	# parse tree is 10^6 levels deep (bash itself overflows its stack here).
+	awk 'BEGIN {
+		ops[0] = ";"; ops[1] = "&&"; ops[2] = "||"
+		for (i = 0; i < 1000000; i++)
+			printf "cd . %s ", ops[i % 3]
+		print "echo deep > out.txt"
+		print "exit"
+	}' >"${IN_FILE}"
+
+	# Commands to execute the test.
+	execute_cmd "$exec_name" "../${IN_FILE}"
+
+	# Test output.
+	basic_test grep -qx deep "${OUT_DIR}/out.txt"
+
+	cleanup_test
+}
+
 test_fun_array=(
 	test_output "Testing commands without arguments" 3
 	test_output "Testing commands with arguments" 2
@@ -222,6 +263,26 @@ test_fun_array=(
 	test_common_alt "Testing sleep command" 7
 	test_common_alt "Testing fscanf function" 7
 	test_exec_failed "Testing unknown command" 4
+	test_compiled "Testing compiled script" 1
+	test_deep_tree "Testing deep command tree" 1
+	test_common "Testing prefix assignments" 1
+	test_common "Testing arithmetic expansion" 1
+	test_common "Testing command substitution" 1
+	test_common "Testing pathname expansion" 1
+	test_common "Testing brace expansion" 1
+	test_common "Testing parameter expansion" 1
+	test_common "Testing here-documents" 1
+	test_common "Testing process substitution" 1
+	test_common "Testing appends to one file" 1
+	test_common "Testing redirection errors" 1
+	test_common "Testing cat" 1
+	test_common "Testing pipeline optimizer" 1
+	test_common "Testing redirection-only commands" 1
+	test_common "Testing the working directory" 1
+	test_exec_failed "Testing grouped parallel output" 1
+	test_exec_failed "Testing the pipeline meter" 1
+	test_exec_failed "Testing output fan-out" 1
+	test_common "Testing batched redirections" 1
 )
 
 # ----------------- Run test ------------------------------------------------- #
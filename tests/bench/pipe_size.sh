@@ -0,0 +1,30 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Throughput of a pipeline moving a lot of data, with the default pipe
+# capacity and with bigger ones (MINI_SHELL_PIPESIZE).
+#
+# Usage: pipe_size.sh [mini-shell] [MiB]
+
+MINI_SHELL=${1:-$(dirname "$0")/../../src/mini-shell}
+MIB=${2:-4096}
+SIZES="default 256K 1M"
+
+run() {
+	local size=$1 start end
+
+	start=$(date +%s%N)
+	{
+		[ "$size" != default ] && echo "MINI_SHELL_PIPESIZE=$size"
+		echo "dd if=/dev/zero bs=1M count=$MIB status=none | dd of=/dev/null bs=1M status=none"
+	} | "$MINI_SHELL" > /dev/null
+	end=$(date +%s%N)
+
+	printf "%-8s %8d ms %8d MiB/s\n" "$size" $(((end - start) / 1000000)) \
+		$((MIB * 1000000000 / (end - start)))
+}
+
+echo "pipe max: $(cat /proc/sys/fs/pipe-max-size) bytes, $MIB MiB per run"
+for size in $SIZES; do
+	run "$size"
+done
@@ -2,7 +2,7 @@
 # SPDX-License-Identifier: BSD-3-Clause
 
 first_test=0
-last_test=18
+last_test=38
 script=./_test/run_test.sh
 
 exec_name="mini-shell"
@@ -28,10 +28,11 @@ BEGIN {
 
 {
 	sum += $(NF-2);
+	max = $(NF-1);
 }
 
 END {
-    printf "\n%s %3d/100\n", "Total:", sum;
+    printf "\n%s %3d/%d\n", "Total:", sum, max;
 }'
 
 # Cleanup testing environment.
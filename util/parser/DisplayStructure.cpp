@@ -25,7 +25,21 @@ static void displayWord(word_t * w)
 	word_t * crt = w;
 
 	while (crt != NULL) {
-		if (crt->expand)
+		if (crt->expand && crt->kind == EXPAND_ARITHMETIC)
+			std::cout << "arith(";
+		else if (crt->expand && crt->kind == EXPAND_COMMAND)
+			std::cout << "subst(";
+		else if (crt->expand && crt->kind == EXPAND_GLOB)
+			std::cout << "glob(";
+		else if (crt->expand && crt->kind == EXPAND_BRACE)
+			std::cout << "brace(";
+		else if (crt->expand && crt->kind == EXPAND_PARAMETER)
+			std::cout << "param(";
+		else if (crt->expand && crt->kind == EXPAND_PROCESS_IN)
+			std::cout << "procin(";
+		else if (crt->expand && crt->kind == EXPAND_PROCESS_OUT)
+			std::cout << "procout(";
+		else if (crt->expand)
 			std::cout << "expand(";
 		std::cout << "'" << crt->string << "'";
 		if (crt->expand)
@@ -63,8 +77,10 @@ static void displaySimple(simple_command_t * s, int level, command_t * father)
 	std::cout << std::setw(2 * indent * level) << "" << "simple_command_t (" << std::endl;
 
 	std::cout << std::setw(2 * indent * level + indent) << "" << "verb (" << std::endl;
-	displayList(s->verb, level + 1);
-	assert(s->verb->next_word == NULL);
+	if (s->verb != NULL) {
+		displayList(s->verb, level + 1);
+		assert(s->verb->next_word == NULL);
+	}
 	std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
 
 	if (s->params != NULL) {
@@ -45,7 +45,8 @@ typedef enum {
  * is NULL if there are no more parts)
 
  * Some parts might need environment variable expansion (expand == true);
- * if that is the case, "string" points to the environment variable name
+ * if that is the case, "string" points to the environment variable name,
+ * or to the text of another expansion, as given by kind
 
  * The next string literal is pointed to by next_word
  * (NULL if there are no more list elements)
@@ -62,9 +63,43 @@ typedef enum {
  * compare the result using string comparison.
  */
 
+/*
+ * What a part that needs expansion (expand == true) stands for
+ * EXPAND_VARIABLE: the value of the variable named by string
+ * EXPAND_ARITHMETIC: the value of the arithmetic expression in string
+ * ("$((x + 1))" is the part "x + 1")
+ * EXPAND_COMMAND: the output of the command line in string, without the
+ * trailing newlines ("$(ls -l)" is the part "ls -l")
+ * EXPAND_GLOB: unquoted text with the pattern characters *, ? or [ that
+ * string holds as it was typed; the word it is part of is replaced by the
+ * paths it matches, if any
+ * EXPAND_BRACE: unquoted text with braces, {a,b} or {1..5}, that string
+ * holds as it was typed; the word it is part of gives one argument for
+ * every string the braces stand for
+ * EXPAND_PARAMETER: the value of the parameter expansion in string, with
+ * its operator applied ("${file%.c}" is the part "file%.c")
+ * EXPAND_PROCESS_IN: a /dev/fd path reading the output of the command line
+ * in string, run alongside the command ("<(ls)" is the part "ls")
+ * EXPAND_PROCESS_OUT: a /dev/fd path writing to the input of the command
+ * line in string (">(wc -l)" is the part "wc -l")
+ * EXPAND_DUMMY can be used to count the number of kinds
+ */
+typedef enum {
+	EXPAND_VARIABLE,
+	EXPAND_ARITHMETIC,
+	EXPAND_COMMAND,
+	EXPAND_GLOB,
+	EXPAND_BRACE,
+	EXPAND_PARAMETER,
+	EXPAND_PROCESS_IN,
+	EXPAND_PROCESS_OUT,
+	EXPAND_DUMMY
+} expand_kind_t;
+
 typedef struct word_t {
 	const char *string;
 	bool expand;
+	expand_kind_t kind;
 	struct word_t *next_part;
 	struct word_t *next_word;
 } word_t;
@@ -79,7 +114,8 @@ typedef struct word_t {
  * aux.
 
  * verb points to a single string literal (possibly made up of parts)
- * that is the executable name or the internal command name.
+ * that is the executable name or the internal command name. It is NULL
+ * for a command made only of redirections ("> file", ">> log").
 
  * params points to a list of parameters (possibly none) in the order
  * they were entered in the command line.
@@ -93,8 +129,13 @@ typedef struct word_t {
 
  * io_flags is used to specify special modes for redirection (e.g. appending)
 
+ * With IO_IN_HEREDOC, in holds the delimiters of the here-documents, one
+ * literal each, as they were typed ("EOF", "'EOF'", "-EOF" for <<-EOF);
+ * the bodies are not part of the line, the last one is the input. With IO_IN_HERESTRING, in is the word of
+ * a here-string (<<<word).
+
  * Some string literals can be found in both the out list and the err list
- * (those entered as "command &> out").
+ * (those entered as "command &> out"), as two literals with the same parts.
 
  * up points to the command_t structure that points to this simple_command_t
  * (up != NULL)
@@ -103,6 +144,8 @@ typedef struct word_t {
 #define IO_REGULAR	0x00
 #define IO_OUT_APPEND	0x01
 #define IO_ERR_APPEND	0x02
+#define IO_IN_HEREDOC	0x04
+#define IO_IN_HERESTRING	0x08
 
 typedef struct {
 	word_t *verb;
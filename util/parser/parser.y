@@ -94,8 +94,8 @@ static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirec
 	pointerToMallocMemory(s);
 
 	memset(s, 0, sizeof(*s));
-	assert(exe_name != NULL);
-	assert(exe_name->next_word == NULL);
+	/* a command of redirections only has no verb */
+	assert(exe_name == NULL || exe_name->next_word == NULL);
 	s->verb = exe_name;
 	s->params = params;
 	s->in = red.red_i;
@@ -170,6 +170,31 @@ static word_t * new_word(const char * str, bool expand)
 }
 
 
+static word_t * new_expansion(const char * str, expand_kind_t kind)
+{
+	word_t * w = new_word(str, true);
+
+	w->kind = kind;
+
+	return w;
+}
+
+
+/*
+ * a word of its own with the parts of w; the lists of redirections are
+ * linked through next_word, so &> cannot put the same word in both
+ */
+static word_t * copy_word(const word_t * w)
+{
+	word_t * c = new_word(w->string, w->expand);
+
+	c->kind = w->kind;
+	c->next_part = w->next_part;
+
+	return c;
+}
+
+
 static word_t * add_part_to_word(word_t * w, word_t * lst)
 {
 	word_t * crt = lst;
@@ -220,6 +245,32 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 }
 
 
+static void add_input(redirect_t * red, word_t * w)
+{
+	/* an input file after a here-document or here-string replaces it */
+	if (red->red_flags & (IO_IN_HEREDOC | IO_IN_HERESTRING)) {
+		red->red_i = NULL;
+		red->red_flags &= ~(IO_IN_HEREDOC | IO_IN_HERESTRING);
+	}
+	red->red_i = add_word_to_list(w, red->red_i);
+}
+
+
+static void set_input(redirect_t * red, word_t * w, int flag)
+{
+	/* every here-document has a body to read, they are all kept */
+	if (flag == IO_IN_HEREDOC && (red->red_flags & IO_IN_HEREDOC)) {
+		red->red_i = add_word_to_list(w, red->red_i);
+		return;
+	}
+
+	/* otherwise the last input redirection wins */
+	red->red_i = w;
+	red->red_flags &= ~(IO_IN_HEREDOC | IO_IN_HERESTRING);
+	red->red_flags |= flag;
+}
+
+
 %}
 
 %union {
@@ -239,6 +290,15 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 %token REDIRECT_APPEND_E REDIRECT_APPEND_O
 %token <string_un> WORD
 %token <string_un> ENV_VAR
+%token <string_un> ARITH_EXPR
+%token <string_un> CMD_SUBST
+%token <string_un> GLOB_WORD
+%token <string_un> BRACE_WORD
+%token <string_un> PARAM_EXPR
+%token <string_un> PROC_SUBST_IN
+%token <string_un> PROC_SUBST_OUT
+%token <string_un> HEREDOC
+%token HERESTRING
 
 %left SEQUENTIAL
 %left PARALLEL
@@ -248,7 +308,7 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 %type <command_un> command
 %type <exe_un> exe_name
 %type <params_un> params
-%type <redirect_un> redirect
+%type <redirect_un> redirect redirect_only
 %type <simple_command_un> simple_command
 %type <word_un> word
 
@@ -336,6 +396,14 @@ simple_command:
 		$$ = bind_parts($1, NULL, $3);
 	}
 
+	| redirect_only {
+		$$ = bind_parts(NULL, NULL, $1);
+	}
+
+	| BLANK redirect_only {
+		$$ = bind_parts(NULL, NULL, $2);
+	}
+
 	;
 
 exe_name:
@@ -371,9 +439,17 @@ redirect:
 		$$.red_flags = IO_REGULAR;
 	}
 
-	| redirect REDIRECT_OE word {
+	| redirect_only {
+		$$ = $1;
+	}
+
+	;
+
+redirect_only:
+
+	  redirect REDIRECT_OE word {
 		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($3), $1.red_e);
 		$$ = $1;
 	}
 
@@ -400,13 +476,13 @@ redirect:
 	}
 
 	| redirect INDIRECT word {
-		$1.red_i = add_word_to_list($3, $1.red_i);
+		add_input(&$1, $3);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_OE word BLANK {
 		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($3), $1.red_e);
 		$$ = $1;
 	}
 
@@ -433,13 +509,13 @@ redirect:
 	}
 
 	| redirect INDIRECT word BLANK {
-		$1.red_i = add_word_to_list($3, $1.red_i);
+		add_input(&$1, $3);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_OE BLANK word {
 		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($4), $1.red_e);
 		$$ = $1;
 	}
 
@@ -466,12 +542,12 @@ redirect:
 	}
 
 	| redirect INDIRECT BLANK word {
-		$1.red_i = add_word_to_list($4, $1.red_i);
+		add_input(&$1, $4);
 		$$ = $1;
 	}
 	| redirect REDIRECT_OE BLANK word BLANK {
 		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($4), $1.red_e);
 		$$ = $1;
 	}
 
@@ -498,7 +574,37 @@ redirect:
 	}
 
 	| redirect INDIRECT BLANK word BLANK {
-		$1.red_i = add_word_to_list($4, $1.red_i);
+		add_input(&$1, $4);
+		$$ = $1;
+	}
+
+	| redirect HEREDOC {
+		set_input(&$1, new_word($2, false), IO_IN_HEREDOC);
+		$$ = $1;
+	}
+
+	| redirect HEREDOC BLANK {
+		set_input(&$1, new_word($2, false), IO_IN_HEREDOC);
+		$$ = $1;
+	}
+
+	| redirect HERESTRING word {
+		set_input(&$1, $3, IO_IN_HERESTRING);
+		$$ = $1;
+	}
+
+	| redirect HERESTRING word BLANK {
+		set_input(&$1, $3, IO_IN_HERESTRING);
+		$$ = $1;
+	}
+
+	| redirect HERESTRING BLANK word {
+		set_input(&$1, $4, IO_IN_HERESTRING);
+		$$ = $1;
+	}
+
+	| redirect HERESTRING BLANK word BLANK {
+		set_input(&$1, $4, IO_IN_HERESTRING);
 		$$ = $1;
 	}
 
@@ -514,6 +620,34 @@ word:
 		$$ = add_part_to_word(new_word($2, true), $1);
 	}
 
+	| word ARITH_EXPR {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_ARITHMETIC), $1);
+	}
+
+	| word CMD_SUBST {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_COMMAND), $1);
+	}
+
+	| word GLOB_WORD {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_GLOB), $1);
+	}
+
+	| word BRACE_WORD {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_BRACE), $1);
+	}
+
+	| word PARAM_EXPR {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_PARAMETER), $1);
+	}
+
+	| word PROC_SUBST_IN {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_PROCESS_IN), $1);
+	}
+
+	| word PROC_SUBST_OUT {
+		$$ = add_part_to_word(new_expansion($2, EXPAND_PROCESS_OUT), $1);
+	}
+
 	| WORD {
 		$$ = new_word($1, false);
 	}
@@ -522,6 +656,34 @@ word:
 		$$ = new_word($1, true);
 	}
 
+	| ARITH_EXPR {
+		$$ = new_expansion($1, EXPAND_ARITHMETIC);
+	}
+
+	| CMD_SUBST {
+		$$ = new_expansion($1, EXPAND_COMMAND);
+	}
+
+	| GLOB_WORD {
+		$$ = new_expansion($1, EXPAND_GLOB);
+	}
+
+	| BRACE_WORD {
+		$$ = new_expansion($1, EXPAND_BRACE);
+	}
+
+	| PARAM_EXPR {
+		$$ = new_expansion($1, EXPAND_PARAMETER);
+	}
+
+	| PROC_SUBST_IN {
+		$$ = new_expansion($1, EXPAND_PROCESS_IN);
+	}
+
+	| PROC_SUBST_OUT {
+		$$ = new_expansion($1, EXPAND_PROCESS_OUT);
+	}
+
 	;
 %%
 